@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * The token cache.
+ *
+ * Lexing does not depend on the pattern, so with --cache=dir what it
+ * finds in a file is kept in dir, one entry per file, named by a hash
+ * of the file's device, inode, size and mtime:
+ *
+ *	struct cthdr		the stat key again, to catch collisions
+ *	struct ctslice [nslice]	the distinct slices of the file
+ *	slice texts
+ *	occurrences
+ *
+ * The occurrences are a run of varints, a slice number and a line number
+ * increment for each.
+ *
+ * A file with an entry is searched by trying the pattern once on each
+ * of its distinct slices; its bytes are only read to print the lines
+ * found. A file without one, or whose entry is damaged, is lexed and
+ * the entry written.
+ *
+ * An entry's mtime is when it was last used, refreshed at most hourly.
+ * After a run that wrote entries, if the cache has grown past its cap
+ * (--cache-size, in megabytes) the least recently used are removed.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cgrep.h"
+
+#define CT_MAGIC	0x0a544743	/* "CGT\n" read as a native integer */
+#define CT_VERSION	1
+#define CT_STALE	3600		/* seconds before a use is noted */
+
+struct cthdr {		/* start of an entry */
+	uint32_t magic;		/* CT_MAGIC, also catches byte order */
+	uint32_t version;	/* CT_VERSION */
+	uint64_t dev;		/* the file it is for */
+	uint64_t ino;
+	int64_t size;
+	int64_t sec;
+	int64_t nsec;
+	uint32_t nslice;	/* distinct slices */
+	uint32_t nocc;		/* occurrences */
+	uint32_t text;		/* bytes of slice texts */
+	uint32_t pad;
+	uint64_t len;		/* bytes in the whole entry */
+};
+
+struct ctslice {	/* a distinct slice */
+	uint32_t off;		/* of its text, from the start of the texts */
+	uint32_t len;
+};
+
+struct ctold {		/* an entry when pruning */
+	char *name;
+	off_t size;
+	time_t used;
+};
+
+const char *cachedir;		/* --cache */
+size_t cachecap = 256;		/* --cache-size, megabytes */
+
+static struct ctslice *slices;	/* of the file being lexed */
+static uint32_t nslice;
+static size_t slicesLen;
+static uint32_t *stab;		/* slice number + 1 by hash, 0 is empty */
+static uint32_t smask;
+static struct post occ;		/* the occurrences */
+static uint32_t nocc, lastline;
+static char *texts;		/* slice texts */
+static size_t textsUsed, textsHas;
+
+static unsigned char *known;	/* per slice: 0 not tried, 1 miss, 2 hit */
+static size_t knownLen;
+static uint32_t *lines;		/* lines found */
+static size_t linesLen;
+
+static size_t hits, misses;	/* for --verbose */
+static char wrote;		/* entries were added */
+
+/*
+ * The slicehook while filling an entry: note an occurrence.
+ */
+static void
+ctslice(const char *p, size_t n, int line)
+{
+	uint32_t slot, i;
+	struct ctslice *sl;
+
+	for (slot = fnv(p, n) & smask; 0 != stab[slot];
+	    slot = (slot + 1) & smask) {
+		sl = &slices[stab[slot] - 1];
+		if (sl->len == n && !memcmp(texts + sl->off, p, n))
+			break;
+	}
+	if (0 == stab[slot]) {
+		ROOM(texts, textsHas, textsUsed + n);
+		memcpy(texts + textsUsed, p, n);
+		TROOM(slices, slicesLen, nslice);
+		slices[nslice].off = textsUsed;
+		slices[nslice].len = n;
+		textsUsed += n;
+		stab[slot] = ++nslice;
+
+		if (nslice > smask / 2) {	/* grow the table */
+			free(stab);
+			smask = 2 * smask + 1;
+			stab = alloc(sizeof(*stab) * (smask + 1));
+			for (i = 0; i < nslice; i++) {
+				for (slot = fnv(texts + slices[i].off,
+				    slices[i].len) & smask; 0 != stab[slot];
+				    slot = (slot + 1) & smask)
+					;
+				stab[slot] = i + 1;
+			}
+			for (slot = fnv(p, n) & smask;
+			    stab[slot] != nslice; slot = (slot + 1) & smask)
+				;
+		}
+	}
+	putv(&occ, stab[slot] - 1);
+	putv(&occ, line - lastline);
+	lastline = line;
+	nocc++;
+}
+
+/*
+ * Whether an entry's slices lie within its texts and its occurrences
+ * within the entry, each naming a slice it has.
+ */
+static int
+ctcheck(const struct cthdr *h)
+{
+	const struct ctslice *sl = (const struct ctslice *)(h + 1);
+	const unsigned char *end = (const unsigned char *)h + h->len;
+	const unsigned char *p, *q;
+	uint32_t i;
+
+	for (i = 0; i < h->nslice; i++)
+		if (sl[i].len > h->text || sl[i].off > h->text - sl[i].len)
+			return 0;
+	p = (const unsigned char *)(sl + h->nslice) + h->text;
+	for (i = 0; i < h->nocc; i++) {
+		q = p;
+		if (!skipv(&p, end) || getv(&q) >= h->nslice ||
+		    !skipv(&p, end))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Print the lines of filen where the slices of an entry match.
+ */
+static void
+ctsearch(const struct ctslice *sl, uint32_t ns, const char *tx,
+    const unsigned char *p, uint32_t no)
+{
+	size_t nl = 0;
+	uint32_t id, line = 0;
+
+	ROOM(known, knownLen, ns);
+	memset(known, 0, ns);
+	for (; no > 0; no--) {
+		id = getv(&p);
+		line += getv(&p);
+		if (id >= ns)
+			break;		/* damaged */
+		if (0 == known[id])
+			known[id] = 1 + match(tx + sl[id].off, sl[id].len);
+		if (2 == known[id] && (0 == nl || lines[nl - 1] != line)) {
+			TROOM(lines, linesLen, nl);
+			lines[nl++] = line;
+		}
+	}
+	if (nl)
+		printlines(lines, nl);
+}
+
+/*
+ * Write the entry just filled for the file st describes to path.
+ */
+static void
+ctwrite(const char *path, const struct stat *st)
+{
+	struct cthdr h;
+	char *tmp;
+	FILE *fp;
+	int bad;
+
+	memset(&h, 0, sizeof(h));
+	h.magic = CT_MAGIC;
+	h.version = CT_VERSION;
+	h.dev = st->st_dev;
+	h.ino = st->st_ino;
+	h.size = st->st_size;
+	h.sec = st->st_mtim.tv_sec;
+	h.nsec = st->st_mtim.tv_nsec;
+	h.nslice = nslice;
+	h.nocc = nocc;
+	h.text = textsUsed;
+	h.len = sizeof(h) + sizeof(*slices) * nslice + textsUsed + occ.len;
+
+	/* written aside and renamed, for runs sharing the cache */
+	if (-1 == asprintf(&tmp, "%s/.%ld", cachedir, (long)getpid()))
+		fatal(outSpace);
+	if (NULL == (fp = fopen(tmp, "w"))) {
+		if (verbose)
+			fprintf(stderr, "%s: cannot write %s\n",
+			    getprogname(), tmp);
+		free(tmp);
+		return;
+	}
+	fwrite(&h, sizeof(h), 1, fp);
+	fwrite(slices, sizeof(*slices), nslice, fp);
+	fwrite(texts, 1, textsUsed, fp);
+	fwrite(occ.p, 1, occ.len, fp);
+	bad = ferror(fp);
+	if (EOF == fclose(fp) || bad || -1 == rename(tmp, path))
+		unlink(tmp);
+	else
+		wrote = 1;
+	free(tmp);
+}
+
+/*
+ * Search filen, from its cache entry if there is a good one, otherwise
+ * by lexing it and making the entry.
+ */
+void
+cachelex(void)
+{
+	const struct cthdr *h;
+	struct stat st, cst;
+	char path[PATH_MAX];
+	uint32_t key[7];
+	char *img;
+	int fd;
+
+	if (-1 == stat(filen, &st) || !S_ISREG(st.st_mode)) {
+		lex();
+		return;
+	}
+	key[0] = st.st_dev;
+	key[1] = (uint64_t)st.st_dev >> 32;
+	key[2] = st.st_ino;
+	key[3] = (uint64_t)st.st_ino >> 32;
+	key[4] = st.st_size;
+	key[5] = st.st_mtim.tv_sec;
+	key[6] = st.st_mtim.tv_nsec;
+	snprintf(path, sizeof(path), "%s/%08x%08x", cachedir,
+	    fnv(key, sizeof(key)), fnv(key, 4 * sizeof(*key)));
+
+	if (-1 != (fd = open(path, O_RDONLY))) {
+		img = MAP_FAILED;
+		if (-1 != fstat(fd, &cst) && (size_t)cst.st_size >= sizeof(*h))
+			img = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE,
+			    fd, 0);
+		close(fd);
+		h = (const struct cthdr *)img;
+		if (MAP_FAILED != img && CT_MAGIC == h->magic &&
+		    CT_VERSION == h->version &&
+		    h->len == (uint64_t)cst.st_size &&
+		    h->dev == (uint64_t)st.st_dev &&
+		    h->ino == (uint64_t)st.st_ino &&
+		    h->size == st.st_size &&
+		    h->sec == st.st_mtim.tv_sec &&
+		    h->nsec == st.st_mtim.tv_nsec &&
+		    h->len >= sizeof(*h) + sizeof(struct ctslice) *
+		    (uint64_t)h->nslice + h->text + 2 * (uint64_t)h->nocc &&
+		    ctcheck(h)) {
+			const struct ctslice *sl =
+			    (const struct ctslice *)(h + 1);
+			const char *tx = (const char *)(sl + h->nslice);
+
+			ctsearch(sl, h->nslice, tx,
+			    (const unsigned char *)tx + h->text, h->nocc);
+			if (cst.st_mtime + CT_STALE < time(NULL))
+				utimes(path, NULL);	/* just used */
+			munmap(img, cst.st_size);
+			hits++;
+			return;
+		}
+		if (MAP_FAILED != img)
+			munmap(img, cst.st_size);
+	}
+
+	/* lex it for the entry, then search that */
+	misses++;
+	if (NULL == stab) {
+		smask = 1023;
+		stab = alloc(sizeof(*stab) * (smask + 1));
+	}
+	else
+		memset(stab, 0, sizeof(*stab) * (smask + 1));
+	nslice = nocc = lastline = 0;
+	textsUsed = occ.len = 0;
+	slicehook = ctslice;
+	lex();
+	slicehook = NULL;
+	ctwrite(path, &st);
+	ctsearch(slices, nslice, texts, occ.p, nocc);
+}
+
+static int
+oldcmp(const void *a, const void *b)
+{
+	const struct ctold *x = a, *y = b;
+
+	return (x->used > y->used) - (x->used < y->used);
+}
+
+/*
+ * If entries were added and the cache is over its cap, remove the least
+ * recently used entries until it fits.
+ */
+void
+cacheprune(void)
+{
+	struct ctold *old = NULL;
+	size_t nold = 0, oldLen = 0, i, evicted = 0;
+	uint64_t total = 0;
+	struct dirent *e;
+	struct stat st;
+	DIR *d;
+
+	if (verbose)
+		fprintf(stderr, "%s: cache: %zu files found, %zu lexed\n",
+		    getprogname(), hits, misses);
+	if (!wrote || NULL == (d = opendir(cachedir)))
+		return;
+	while (NULL != (e = readdir(d))) {
+		if ('.' == e->d_name[0] ||
+		    -1 == fstatat(dirfd(d), e->d_name, &st, 0))
+			continue;
+		TROOM(old, oldLen, nold);
+		if (NULL == (old[nold].name = strdup(e->d_name)))
+			fatal(outSpace);
+		old[nold].size = st.st_size;
+		old[nold].used = st.st_mtime;
+		total += st.st_size;
+		nold++;
+	}
+
+	if (total > (uint64_t)cachecap << 20) {
+		qsort(old, nold, sizeof(*old), oldcmp);
+		for (i = 0; i < nold && total > (uint64_t)cachecap << 20; i++)
+			if (-1 != unlinkat(dirfd(d), old[i].name, 0)) {
+				total -= old[i].size;
+				evicted++;
+			}
+		if (verbose)
+			fprintf(stderr, "%s: cache: %zu entries evicted\n",
+			    getprogname(), evicted);
+	}
+	closedir(d);
+	for (i = 0; i < nold; i++)
+		free(old[i].name);
+	free(old);
+}
@@ -74,9 +74,20 @@
  *
  * -n puts a line number on found lines.
  *
- * -s List all strings. This form takes no pattern.
+ * -s List all strings. This form takes no pattern unless -e is used.
  *
- * -c List all comments. This form takes no pattern.
+ * -c List all comments. This form takes no pattern unless -e is used.
+ *
+ * -e Gives the pattern as an option rather than the first argument. With
+ *    -s or -c only strings or comments containing a match for the pattern
+ *    are listed; this is an ordinary egrep search, not a full match. -e
+ *    may be given more than once, any of the patterns will do. A string
+ *    is searched with its escapes decoded, so -s -e 'a.b' finds "a\tb",
+ *    and printed as written. A comment is searched whole, its lines
+ *    joined by newlines, and all its lines are printed, so -c -e
+ *    'TODO.*bug' finds a TODO whose bug is on the next line. With -l and
+ *    -e just the names of files with such strings or comments are listed;
+ *    -l with -s or -c but no -e prints them all, as it always has.
  *
  * -A builds a tmp file and calls 'me' to process the file with the tmp file
  *    as an "error" list like the -A option of cc. Each line of this list
@@ -96,27 +107,212 @@
  * -r Replaces all occurances of the pattern with "new". This form only matches
  *    simple tokens, not things like "ptr->val". -r is incompatible with all
  *    other options.
+ *    A changed file is put together beside the original and renamed over
+ *    it, keeping its mode; only the replacements are written, the rest
+ *    copied from the old file (with copy_file_range(2) on Linux, so file
+ *    systems that can share blocks need not copy them).
+ *    In "new", \0 is the identifier found and \1 to \9 what the
+ *    pattern's parentheses matched, as regsub(3) does, and then \\ is
+ *    a backslash; a "new" with none of \0 to \9 is taken as it is.
+ *    -r 'set_\1' -e 'get_(.*)' turns get_x into set_x.
+ *
+ * --rename-map=file
+ *    Like -r with many patterns at once: file holds lines of old<TAB>new,
+ *    and every identifier that is an old name becomes its new one. The
+ *    names are looked up in a hash table, so each file is read and
+ *    rewritten once however long the list. Takes no pattern. Renames are
+ *    made together, so a<TAB>b and b<TAB>a swap a and b.
+ *
+ * -f Takes the patterns from a file, one per line, instead of the command
+ *    line. A hit on any one of them is a hit. Patterns with no
+ *    metacharacters are looked up in a hash table, so a long list of names
+ *    costs little more than one.
+ *
+ * --compile-patterns out.cgp
+ *    Compiles the pattern (or -f list) into out.cgp and exits.
+ *
+ * --patterns in.cgp
+ *    Maps in patterns saved by --compile-patterns instead of taking a
+ *    pattern, so nothing is compiled at startup. The file carries a version
+ *    and checksum and is refused if either is wrong.
+ *
+ * --verbose
+ *    Reports on stderr how cgrep chose to run the pattern: after timing
+ *    the first identifiers it may switch to remembering the answer for
+ *    each distinct identifier when the pattern is expensive.
+ *
+ * --fuzzy=k
+ *    Takes the pattern as a literal, not an egrep pattern, and finds
+ *    identifiers and chains within k insertions, deletions or changes of
+ *    it, so "cgrep --fuzzy=2 recieve_msg" finds receive_msg and recv_msg.
+ *    One pass costs about as much as looking for the literal itself.
+ *
+ * --index build dir ...
+ *    Lexes every C source under each dir and writes dir/.cgrepidx, a
+ *    dictionary of the distinct identifiers and chains with the lines
+ *    they are found on. Takes no pattern.
+ *
+ * --index query pattern dir ...
+ *    Searches the sources under each dir using its index: the pattern is
+ *    only tried against the dictionary. Files changed since the build
+ *    (by mtime or size) or new ones are lexed as usual. Works with -l and
+ *    -n but not -A or -r.
+ *
+ *    With -s or -c and -e the index is also used: it holds the trigrams of
+ *    every string and comment, and only files holding all the trigrams
+ *    the pattern needs are lexed.
+ *
+ * --serve=sock path ...
+ *    Runs a daemon holding the sources named (directories are searched for
+ *    them) in memory, with their identifiers already lexed, and answers
+ *    queries made with --connect on the Unix socket sock. Files are
+ *    checked by mtime and size before each query and reread if changed;
+ *    new files need a restart. Takes only --verbose.
+ *
+ * --connect=sock [options] [pattern]
+ *    Has the --serve daemon on sock run the query over its files, with
+ *    the results written straight to our output. Files may not be given,
+ *    nor -A, -r, --index or --compile-patterns.
+ *
+ * --watch
+ *    Searches the sources under the directories (or files) named, then
+ *    keeps watching them: whenever files are written, created or removed
+ *    just those are lexed again, and the hits gained and lost are printed
+ *    prefixed with + and -. Runs until killed.
+ *
+ * --cache=dir [--cache-size=mb]
+ *    Keeps what lexing finds in each file in dir, keyed by the file's
+ *    inode, size and mtime, so later searches of unchanged files just try
+ *    the pattern on their distinct identifiers and chains. The least
+ *    recently used entries go when dir outgrows mb megabytes (256).
+ *
+ * --results=dir
+ *    Keeps the hits of each file in dir for these patterns and switches.
+ *    Files whose inode, size and mtime are unchanged are answered from
+ *    dir without being read; those whose bytes are unchanged, without
+ *    being lexed. For checks run over and over on a mostly unchanged tree.
+ *
+ * --checkpoints=file
+ *    For a single file searched again and again as it is edited. The
+ *    lexer's state every few kilobytes is kept in file, with the hits.
+ *    The next search lexes only from the last checkpoint before the first
+ *    change until its state agrees with the old run's again, taking the
+ *    rest of the hits from file.
+ *
+ * --tags=file [--jobs=n]
+ *    Also writes a ctags(1) file of the functions, structs, unions,
+ *    enums, typedefs and macros defined in the files searched, found in
+ *    the same pass. The pattern must then be given with -e or -f, and may
+ *    be left out to just make tags. Directories are searched for sources.
+ *    The files are shared among n workers, one per processor by default.
+ *
+ * --git [--changed-since=rev]
+ *    Searches the sources in the git index under the current directory,
+ *    in place of files named, reading .git/index itself. With
+ *    --changed-since, just those whose index entry differs from rev's
+ *    tree or that were edited after being staged.
+ *
+ * --rev=rev ...
+ *    Searches the sources under the current directory as they are in
+ *    revision rev, read from the object store without checking it out,
+ *    naming them rev:path. May be given more than once; a file the same
+ *    in several revisions is searched once. No files may be given.
+ *
+ * --include=glob, --exclude=glob
+ *    Choose the files taken from directories, the index, revisions and
+ *    archives: with --include, those matching one of the globs rather
+ *    than those with C suffixes; never those matching an --exclude. A
+ *    glob with a / is matched against the whole path.
+ *
+ * A file named .tar, .tar.gz or .tgz is read as an archive, a member at
+ * a time, without extracting it; hits in it are named archive:member.
+ * The largest member is held in memory whole. Archives are searched
+ * only when named, and not with --tags, --checkpoints, --watch,
+ * --serve, --index or --rev.
+ *
+ * --json, --null
+ *    Print each hit as a record for other programs, rather than the line:
+ *    its file, the line and column (from 1) and byte offset (from 0) in
+ *    the file where it starts, its length in the source, and the chain
+ *    slice that matched. Every matching slice of a chain is a hit, as
+ *    with -A. --json writes a JSON object per line, with the keys path,
+ *    line, column, offset, length and match; --null writes the six
+ *    fields each ended by a NUL. Stdin is named "-". With -l just the
+ *    names are written, as {"path":...} or ended by a NUL. Not with -A,
+ *    -r, -s, -c, or the cached, indexed or served searches.
+ *
+ * --query=expr
+ *    Lists the files of which expr is true, in one pass over each: expr
+ *    joins patterns with AND, OR, NOT and parentheses, and a NEAR b is
+ *    true where a and b are found on the same line, NEAR/n within n
+ *    lines. So --query='lock_acquire AND NOT lock_release' finds the
+ *    files that take the lock but never let it go. A file is left as
+ *    soon as the answer is known. A pattern starting with ( or spelled
+ *    like an operator is put in double quotes. Takes no other pattern;
+ *    not with -A, -r, -s, -c, -n, --fuzzy, --quickfix, --rev, --tags or
+ *    the cached, checkpointed, indexed or served searches.
+ *
+ * --tokens=seq
+ *    Finds sequences of tokens rather than identifiers and chains. seq
+ *    is a list of elements separated by spaces: punctuation, written as
+ *    it is (each character a token, so -> is - then >); gaps, ... for
+ *    any number of tokens and ...n for at most n, which do not pass a ;
+ *    { or } and must have an element after them; and patterns for
+ *    identifiers, matched as the usual pattern is, anything else or
+ *    anything in double quotes. A number is its digits, like
+ *    punctuation; strings and character constants are passed over. So
+ *    	cgrep --tokens='memcpy ( ... sizeof' *.c
+ *    finds the memcpy calls with a sizeof in them. A hit is reported on
+ *    the line with its last token. Takes no other pattern; only with -l,
+ *    -n, --git, --include and --exclude.
+ *
+ * --quickfix=file
+ *    In place of -A for any editor: every hit, each matching slice of a
+ *    chain as with -A, goes to one list for the whole run, file, in the
+ *    grep form file:line:column:text that vi's quickfix and emacs's
+ *    grep-mode read, rather than to the output. Written as each file is
+ *    searched, and as each hit is found if file is a FIFO, so an editor
+ *    can take it up while cgrep is still running. Not with the options
+ *    --json is not, nor -l, --tags or --rev.
  */
 
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include "regexp.h"
+#include "cgrep.h"
 
 __dead
 static void
 usage(void)
 {
 
-	fprintf(stderr, "%s [-r newStr] [-clnsA] [pattern] filename ...\n",
+	fprintf(stderr, "%s [-r newStr] [-clnsA] [-e pattern] [-f patfile] "
+		"[--patterns file.cgp] [--compile-patterns out.cgp] [--verbose] "
+		"[--fuzzy=k] [--index build|query] [--serve|--connect=sock] "
+		"[--watch] [--cache=dir [--cache-size=mb]] [--results=dir] "
+		"[--checkpoints=file] [--tags=file [--jobs=n]] "
+		"[--git [--changed-since=rev]] [--rev=rev ...] "
+		"[--include=glob] [--exclude=glob] [--json|--null] "
+		"[--quickfix=file] [--rename-map=file] [--query=expr] "
+		"[--tokens=seq] "
+		"[pattern] filename ...\n",
 		getprogname());
 	exit(1);
 }
 
-static void *
+void *
 alloc(size_t n)
 {
 	void *buf;
@@ -131,7 +327,7 @@ alloc(size_t n)
 }
 
 __dead
-static void
+void
 fatal(char *s, ...)
 {
 	va_list ap;
@@ -144,22 +340,27 @@ fatal(char *s, ...)
 }
 
 /*
- * Cgrep never runs out of room on lines or buffers until malloc fails
- * these are buffer expanders.
+ * FNV-1a hash of n bytes.
  */
-#define TROOM(buf, has, needs)	while ((needs) >= has) \
- if (NULL == (buf = realloc(buf, sizeof(*buf) * (has += 10)))) \
-  fatal(outSpace)
+uint32_t
+fnv(const void *p, size_t n)
+{
+	const unsigned char *s = p;
+	uint32_t h = 2166136261U;
 
-#define ROOM(buf, has, needs)	while ((needs) >= has) \
- if (NULL == (buf = realloc(buf, has += 512))) \
-  fatal(outSpace)
+	while (n--)
+		h = (h ^ *s++) * 16777619U;
+	return h;
+}
 
-static char outSpace[] = "cgrep: out of space";
+char outSpace[] = "cgrep: out of space";
 
 struct token {	/* collected token array */
 	int start;	/* token index on buff */
 	int atline;	/* line number where token spotted */
+	int col;	/* and column */
+	size_t off;	/* offset in the input */
+	char listed;	/* in the --quickfix list */
 };
 
 enum fstate {	/* lexical processing state */
@@ -190,23 +391,106 @@ static int tokenLen;		/* size of token array */
 static char *line;		/* expandable input line */
 static int  lineLen;		/* current length of input line */
 
+static char *ibuf;		/* whole input file, mapped or read in */
+static size_t ibufLen;		/* length of ibuf */
+static char imapped;		/* 1 if ibuf is mmap()ed, 0 if malloc()ed, */
+				/* 2 if given by setinput() */
+static const char *given;	/* input given by setinput() */
+static size_t givenLen;
+
 static char lswitch;		/* list files found */
 static char aswitch;		/* call emacs with line list */
 static char nswitch;		/* print line number */
 static char sswitch;		/* print all strings */
 static char cswitch;		/* print all comments */
 static char rswitch;		/* replace found pattern */
-
-static regexp *pat;		/* a compiled regular expression */
+static char pfswitch;		/* patterns from -f file */
+static char qswitch;		/* --query */
+static char tswitch;		/* --tokens */
+static char oformat;		/* 'j' --json or '0' --null records */
+char verbose;			/* --verbose */
+char served;			/* answering for a --serve daemon */
+
+static struct patset *pats;	/* the compiled patterns */
+static struct fuzzy *fuzz;	/* or the --fuzzy automaton */
+static regexp *tpat;		/* -e pattern for -s and -c */
+static char *tpatsrc;		/* and its source */
 
 static char *newstr;		/* The new string with rswitch */
 
-static char *filen = NULL;	/* the file currently being processed */
+struct edit {		/* a word -r replaces */
+	size_t off;		/* in the input */
+	size_t len;
+	size_t to;		/* with this, in subs */
+	size_t tolen;
+};
+
+struct rename {		/* an entry of --rename-map */
+	const char *from;
+	const char *to;
+	size_t len;		/* of from */
+};
+
+static struct rename *renames;	/* hash table of them */
+static size_t renamesLen, nrename;
+static char *subs;		/* this input's replacements */
+static size_t subsLen, subsUsed;
+static size_t rento, rentoLen;	/* what the last word found becomes */
+static int nsub;		/* \digits in newstr */
+
+static struct edit *edits;	/* this input's, in order */
+static int nedit, editsLen;
+
+char *filen = NULL;		/* the file currently being processed */
 static char *tname = NULL;	/* temp file name */
 static FILE *tfp;		/* tmp file pointer */
+static FILE *qfp;		/* --quickfix list */
 
 static int lineno;		/* current line number */
 static int marked;		/* 1 if pattern found on line. */
+static size_t bol;		/* offset of the line's start */
+static enum wstate chain = other;	/* word processing state */
+
+static char *sbuf;		/* a string, decoded */
+static size_t sbufLen;
+static char *ctext;		/* a comment, its lines joined by newlines */
+static size_t ctextLen, ctextUsed;
+static int cline;		/* line it starts on, 0 if none */
+
+struct lexpoint lexfrom = { 0, 1, start };	/* where lex() starts */
+
+/*
+ * If set, gota() hands every slice it would match to slicehook along
+ * with its line number instead of matching it.
+ */
+void (*slicehook)(const char *, size_t, int);
+
+/*
+ * If set, every string and comment body is handed to texthook with
+ * its kind, 's' or 'c', instead of being reported: strings with their
+ * escapes decoded, comments whole.
+ */
+void (*texthook)(const char *, size_t, int);
+
+/*
+ * If set, every line found is handed to hithook with its line number
+ * instead of being printed.
+ */
+void (*hithook)(const char *, int);
+
+/*
+ * If set, lex() calls ckhook at the start of each line it could resume
+ * from, with the offset, line number and state to do it with, and stops
+ * if ckhook returns nonzero.
+ */
+int (*ckhook)(size_t, int, int);
+
+/*
+ * If set, lex() hands tokhook each identifier (c is 0) and each
+ * punctuation character c outside strings and comments, with its line,
+ * and at the end of the input EOF with all of it.
+ */
+void (*tokhook)(int, const char *, size_t, int);
 
 /*
  * Report errors for public domain regexp package.
@@ -218,12 +502,34 @@ char *s;
 	fatal("%s: pattern error %s\n", getprogname(), s);
 }
 
+/*
+ * Does the slice p, n match what we are looking for?
+ */
+int
+match(const char *p, size_t n)
+{
+	if (NULL != fuzz)
+		return fzmatch(fuzz, p, n);
+	return psmatch(pats, p, n);
+}
+
+/*
+ * The tokhook for --tokens: move the sequence on by the token.
+ */
+static void
+seqtok(int c, const char *w, size_t n, int line)
+{
+	(void)line;
+	if (tsstep(c, w, n))
+		marked = 1;
+}
+
 /*
  * Pattern found with -A mode. It is assumed that users of
  * this mode will want to know about all hits on a line.
  */
 static void
-emacsLine(char *found, int atline)
+emacsLine(const char *found, size_t len, int atline)
 {
 	extern char *tempnam();
 
@@ -232,7 +538,240 @@ emacsLine(char *found, int atline)
 	    ((NULL == (tname = tempnam(NULL, "cgr"))) ||
              (NULL == (tfp = fopen(tname, "w")))))
 		fatal("%s: Cannot open tmp file", getprogname());
-	fprintf(tfp, "%d: %s: found '%s'\n", atline, filen, found);
+	fprintf(tfp, "%d: %s: found '%.*s'\n", atline, filen, (int)len, found);
+}
+
+/*
+ * Print the hit line of n bytes at s in the input, followed there by its
+ * newline unless it ends the input, as printx() would, but pointing at
+ * the line rather than copying it. Like printx() it stops at a NUL.
+ */
+static void
+printref(const char *s, size_t n)
+{
+	const char *nul;
+
+	if (NULL != filen) {
+		oputs(filen);
+		owrite(": ", 2);
+	}
+	if (nswitch) {
+		onum(lineno, 4);
+		owrite(": ", 2);
+	}
+	if (NULL != (nul = memchr(s, '\0', n))) {
+		oref(s, nul - s);
+		owrite("\n", 1);
+	}
+	else if (s + n < ibuf + ibufLen)
+		oref(s, n + 1);
+	else {
+		oref(s, n);
+		owrite("\n", 1);
+	}
+}
+
+/*
+ * Add a hit at token t to the --quickfix list, with the line it starts
+ * on. Slices of a chain starting at the same token make one entry.
+ */
+static void
+qfhit(struct token *t)
+{
+	const char *s = ibuf + t->off - (t->col - 1), *e;
+
+	if (t->listed)
+		return;
+	t->listed = 1;
+
+	if (NULL == (e = memchr(s, '\n', ibuf + ibufLen - s)))
+		e = ibuf + ibufLen;
+	fprintf(qfp, "%s:%d:%d:%.*s\n", (NULL != filen) ? filen : "-",
+	    t->atline, t->col, (int)(e - s), s);
+}
+
+/*
+ * Print filen for -l.
+ */
+static void
+printname(void)
+{
+	const char *name = (NULL != filen) ? filen : "-";
+
+	if ('j' == oformat) {
+		owrite("{\"path\":", 8);
+		ojson(name, strlen(name));
+		owrite("}\n", 2);
+	}
+	else if ('0' == oformat)
+		owrite(name, strlen(name) + 1);
+	else {
+		oputs(name);
+		owrite("\n", 1);
+	}
+}
+
+/*
+ * Print a hit for --json or --null: the chain slice s of n bytes, found
+ * at token t and running len bytes in the input.
+ */
+static void
+printrec(const struct token *t, size_t len, const char *s, size_t n)
+{
+	const char *name = (NULL != filen) ? filen : "-";
+
+	if ('j' == oformat) {
+		owrite("{\"path\":", 8);
+		ojson(name, strlen(name));
+		owrite(",\"line\":", 8);
+		onum(t->atline, 0);
+		owrite(",\"column\":", 10);
+		onum(t->col, 0);
+		owrite(",\"offset\":", 10);
+		onum(t->off, 0);
+		owrite(",\"length\":", 10);
+		onum(len, 0);
+		owrite(",\"match\":", 9);
+		ojson(s, n);
+		owrite("}\n", 2);
+		return;
+	}
+	owrite(name, strlen(name) + 1);
+	onum(t->atline, 0);
+	owrite("", 1);
+	onum(t->col, 0);
+	owrite("", 1);
+	onum(t->off, 0);
+	owrite("", 1);
+	onum(len, 0);
+	owrite("", 1);
+	owrite(s, n);
+	owrite("", 1);
+}
+
+/*
+ * The slot in renames for the n byte name at w: its entry, or the empty
+ * one where it would go.
+ */
+static struct rename *
+renslot(const char *w, size_t n)
+{
+	size_t i;
+
+	for (i = fnv(w, n) & (renamesLen - 1); NULL != renames[i].from;
+	    i = (i + 1) & (renamesLen - 1))
+		if (n == renames[i].len && !memcmp(w, renames[i].from, n))
+			break;
+	return &renames[i];
+}
+
+/*
+ * What --rename-map makes the n byte identifier at w, or NULL.
+ */
+static const char *
+renfind(const char *w, size_t n)
+{
+	return renslot(w, n)->to;
+}
+
+/*
+ * Load the old<TAB>new lines of file into renames.
+ */
+static void
+renmap(const char *file)
+{
+	struct rename *old, *r;
+	FILE *fp;
+	char *p = NULL, *tab;
+	size_t has = 0, i, oldLen;
+	ssize_t n;
+	int lno = 0;
+
+	if (NULL == (fp = fopen(file, "r")))
+		fatal("%s: cannot open %s\n", getprogname(), file);
+	while (-1 != (n = getline(&p, &has, fp))) {
+		lno++;
+		if (n && '\n' == p[n - 1])
+			p[--n] = '\0';
+		if (0 == n)
+			continue;
+		if (NULL == (tab = strchr(p, '\t')) || tab == p ||
+		    '\0' == tab[1])
+			fatal("%s: %s:%d: not old<TAB>new\n", getprogname(),
+			    file, lno);
+
+		if (2 * (nrename + 1) > renamesLen) {	/* grow, rehash */
+			old = renames;
+			oldLen = renamesLen;
+			renamesLen = renamesLen ? 2 * renamesLen : 1024;
+			renames = alloc(renamesLen * sizeof(*renames));
+			memset(renames, 0, renamesLen * sizeof(*renames));
+			for (i = 0; i < oldLen; i++)
+				if (NULL != old[i].from)
+					*renslot(old[i].from, old[i].len) =
+					    old[i];
+			free(old);
+		}
+		*tab = '\0';
+		r = renslot(p, tab - p);
+		if (NULL != r->from)
+			fatal("%s: %s:%d: %s is renamed twice\n",
+			    getprogname(), file, lno, p);
+		r->len = tab - p;
+		if (NULL == (r->from = strdup(p)) ||
+		    NULL == (r->to = strdup(tab + 1)))
+			fatal(outSpace);
+		nrename++;
+	}
+	free(p);
+	fclose(fp);
+	if (0 == nrename)
+		fatal("%s: %s has no renames\n", getprogname(), file);
+}
+
+/*
+ * Add the n bytes at s to subs as what the word just found becomes.
+ */
+static void
+subput(const char *s, size_t n)
+{
+	ROOM(subs, subsLen, subsUsed + n);
+	memcpy(subs + subsUsed, s, n);
+	rento = subsUsed;
+	rentoLen = n;
+	subsUsed += n;
+}
+
+/*
+ * The word w of n bytes is a hit for -r and newstr has \digits: put
+ * what it becomes in subs. The pattern's groups are one further on than
+ * the user wrote them, behind the ^( )$ it is wrapped in, and a literal
+ * pattern or --fuzzy has only \0.
+ */
+static void
+substitute(const char *w, size_t n)
+{
+	regexp *re, sub;
+	int i;
+
+	memset(&sub, 0, sizeof(sub));
+	if (NULL != fuzz || NULL == (re = psfind(pats, w, n))) {
+		sub.startp[0] = (char *)w;
+		sub.endp[0] = (char *)w + n;
+	}
+	else {
+		sub.startp[0] = re->startp[0];
+		sub.endp[0] = re->endp[0];
+		for (i = 1; i < NSUBEXP - 1; i++) {
+			sub.startp[i] = re->startp[i + 1];
+			sub.endp[i] = re->endp[i + 1];
+		}
+	}
+	ROOM(subs, subsLen, subsUsed + strlen(newstr) + nsub * n + 1);
+	regsub(&sub, newstr, subs + subsUsed);
+	rento = subsUsed;
+	rentoLen = strlen(subs + subsUsed);
+	subsUsed += rentoLen;
 }
 
 /*
@@ -244,29 +783,40 @@ emacsLine(char *found, int atline)
  * that is when the x in ptr->memb.x was found cgrep would check
  * ptr->memb.x then memb.x then x
  * against the pattern. Thus memb.x matches ptr->memb.x
+ *
+ * what is a slice of len bytes, not NUL-terminated, and buff is
+ * never terminated either; slices of it are matched with regnexec().
  */
 static void
-gota(got, what)
-register enum wstate got;	/* what we have */
-char *what;		/* the string we have or NULL */
+gota(enum wstate got, const char *what, size_t len)
 {
 	static int tokenCt;	    /* number of tokens */
-	static enum wstate state;   /* current word processing state */
-	static int wlen, blen;	    /* strlen(what) and strlen(buff) + 1 */
+	static int blen;	    /* bytes used in buff */
+	const char *to;
 	int i;
 
-	if (sswitch || cswitch)
+	if (sswitch || cswitch || tswitch)
 		return;
 
 	if (rswitch) {	/* replace mode works on tokens only */
-		marked = (word == got) && regexec(pat, what);
+		if (NULL != renames) {
+			marked = (word == got) &&
+			    NULL != (to = renfind(what, len));
+			if (marked)
+				subput(to, strlen(to));
+		}
+		else if ((marked = (word == got) && match(what, len))) {
+			if (nsub)
+				substitute(what, len);
+			else
+				subput(newstr, strlen(newstr));
+		}
 		return;
 	}
 
 	switch (got) {
 	case word:
-		wlen = strlen(what);
-		switch (state) {
+		switch (chain) {
 		case other:
 		case word:
 			/* store start and line number of token */
@@ -274,31 +824,42 @@ char *what;		/* the string we have or NULL */
 			TROOM(tokens, tokenLen, tokenCt);
 			tokens[0].start = 0;
 			tokens[0].atline = lineno;
-
-			/* store token */
-			blen = wlen;
-			ROOM(buff, buffLen, blen);
-			strcpy(buff, what);
+			tokens[0].off = what - ibuf;
+			tokens[0].col = what - ibuf - bol + 1;
+			tokens[0].listed = 0;
+			blen = 0;
 			break;
 		case dot:
 			/* store start and line number of token */
 			TROOM(tokens, tokenLen, tokenCt);
 			tokens[tokenCt].start = blen;
+			tokens[tokenCt].off = what - ibuf;
+			tokens[tokenCt].col = what - ibuf - bol + 1;
+			tokens[tokenCt].listed = 0;
 			tokens[tokenCt++].atline = lineno;
-
-			/* store token */
-			blen += wlen;
-			ROOM(buff, buffLen, blen);
-			strcat(buff, what);
 		}
 
+		/* store token */
+		ROOM(buff, buffLen, blen + len);
+		memcpy(buff + blen, what, len);
+		blen += len;
+
 		/* Check the accumulated token for matches */
 		for (i = 0; i < tokenCt; i++) {
-			char *p;
+			char *p = buff + tokens[i].start;
 
-			if (regexec(pat, p = buff + tokens[i].start)) {
+			if (NULL != slicehook)
+				(*slicehook)(p, blen - tokens[i].start, lineno);
+			else if (match(p, blen - tokens[i].start)) {
 				if (aswitch)
-					emacsLine(p, tokens[i].atline);
+					emacsLine(p, blen - tokens[i].start,
+					    tokens[i].atline);
+				else if (oformat && !lswitch)
+					printrec(&tokens[i],
+					    what + len - ibuf - tokens[i].off,
+					    p, blen - tokens[i].start);
+				else if (NULL != qfp)
+					qfhit(&tokens[i]);
 				else {
 					marked = 1;
 					break;
@@ -306,19 +867,19 @@ char *what;		/* the string we have or NULL */
 			}
 		}
 
-		state = got;
+		chain = got;
 		break;
 
 	case dot:
-		if (word == state) {
-			blen += strlen(what);
-			ROOM(buff, buffLen, blen);
-			strcat(buff, what);
-			state = got;
+		if (word == chain) {
+			ROOM(buff, buffLen, blen + len);
+			memcpy(buff + blen, what, len);
+			blen += len;
+			chain = got;
 			break;
 		}
 	case other:
-		state = other;
+		chain = other;
 	}
 }
 
@@ -368,56 +929,416 @@ static void
 printx(s)
 char *s;
 {
-	if (aswitch)
-		emacsLine(s, lineno);
+	if (NULL != hithook)
+		(*hithook)(s, lineno);
+	else if (aswitch)
+		emacsLine(s, strlen(s), lineno);
 	else {
-		if (NULL != filen)
-			printf("%s: ", filen);
-		if (nswitch)
-			printf("%4d: ", lineno);
-		printf("%s\n", s);
+		if (NULL != filen) {
+			oputs(filen);
+			owrite(": ", 2);
+		}
+		if (nswitch) {
+			onum(lineno, 4);
+			owrite(": ", 2);
+		}
+		oputs(s);
+		owrite("\n", 1);
 	}
 }
 
 /*
- * Lexically process a file.
+ * Make the next lex() or printlines() take its input from buf rather
+ * than reading filen, which still names it.
  */
-static void
-lex()
+void
+setinput(const char *buf, size_t len)
 {
-	int  c, i;
-	enum fstate state, pstate;
-	char *w, changed;
-	FILE *ifp, *tfp;
+	given = buf;
+	givenLen = len;
+}
+
+/*
+ * Bring the whole input into ibuf. Regular files are mapped, anything
+ * else (stdin, pipes) is read in. Returns -1 if the file can't be opened.
+ */
+static int
+mapin(void)
+{
+	struct stat st;
+	ssize_t n;
+	size_t has;
+	int fd;
+
+	if (NULL != given) {
+		ibuf = (char *)given;
+		ibufLen = givenLen;
+		imapped = 2;
+		given = NULL;
+		return 0;
+	}
 
 	if (NULL == filen)
-		ifp = stdin;
-	else if (NULL == (ifp = fopen(filen, "r"))) {
+		fd = STDIN_FILENO;
+	else if (-1 == (fd = open(filen, O_RDONLY)))
+		return -1;
+
+	ibufLen = 0;
+	if ((-1 != fstat(fd, &st)) && S_ISREG(st.st_mode) && st.st_size > 0) {
+		ibuf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (MAP_FAILED != ibuf) {
+			imapped = 1;
+			ibufLen = st.st_size;
+			goto done;
+		}
+	}
+
+	imapped = 0;
+	ibuf = NULL;
+	has = 0;
+	for (;;) {
+		ROOM(ibuf, has, ibufLen + BUFSIZ);
+		if ((n = read(fd, ibuf + ibufLen, has - ibufLen)) <= 0)
+			break;
+		ibufLen += n;
+	}
+done:
+	if (STDIN_FILENO != fd)
+		close(fd);
+	return 0;
+}
+
+/*
+ * Release the input brought in by mapin().
+ */
+static void
+unmapin(void)
+{
+	orelease();		/* hits may point into it */
+	if (1 == imapped)
+		munmap(ibuf, ibufLen);
+	else if (0 == imapped)
+		free(ibuf);
+	ibuf = NULL;
+}
+
+/*
+ * Print s, found at line, for -s or -c; with -l and -e just note the
+ * file has a hit.
+ */
+static void
+texthit(char *s, int line)
+{
+	int was = lineno;
+
+	if (lswitch && NULL != tpat) {
+		marked = 1;
+		return;
+	}
+	lineno = line;
+	printx(s);
+	lineno = was;
+}
+
+/*
+ * Decode the escapes of the string body s into sbuf, returning its
+ * length; it may hold NULs.
+ */
+static size_t
+unescape(const char *s)
+{
+	size_t n = 0;
+	int c, k;
+
+	ROOM(sbuf, sbufLen, strlen(s));
+	while ('\0' != (c = (unsigned char)*s++)) {
+		if ('\\' != c || '\0' == *s) {
+			sbuf[n++] = c;
+			continue;
+		}
+		switch (c = (unsigned char)*s++) {
+		case 'a': c = '\a'; break;
+		case 'b': c = '\b'; break;
+		case 'f': c = '\f'; break;
+		case 'n': c = '\n'; break;
+		case 'r': c = '\r'; break;
+		case 't': c = '\t'; break;
+		case 'v': c = '\v'; break;
+		case 'x':
+			for (c = 0; isxdigit((unsigned char)*s); s++)
+				c = c << 4 | (isdigit((unsigned char)*s) ?
+				    *s - '0' : (tolower((unsigned char)*s) -
+				    'a' + 10));
+			break;
+		default:
+			if (c >= '0' && c <= '7')
+				for (c -= '0', k = 1; k < 3 &&
+				    *s >= '0' && *s <= '7'; k++)
+					c = c << 3 | (*s++ - '0');
+		}
+		sbuf[n++] = c;
+	}
+	return n;
+}
+
+/*
+ * The string body s, as in the source, has been delimited. Hand it to
+ * texthook decoded, or print it for -s if decoded it contains the -e
+ * pattern or there is none.
+ */
+static void
+strtext(char *s)
+{
+	size_t n;
+
+	if (NULL == texthook && (!sswitch || NULL == tpat)) {
+		if (sswitch)
+			texthit(s, lineno);
+		return;
+	}
+	n = unescape(s);
+	if (NULL != texthook)
+		(*texthook)(sbuf, n, 's');
+	else if (regnexec(tpat, sbuf, n))
+		texthit(s, lineno);
+}
+
+/*
+ * Add s, the part of a comment on this line, to ctext.
+ */
+static void
+comadd(const char *s)
+{
+	size_t n = strlen(s);
+
+	ROOM(ctext, ctextLen, ctextUsed + n + 1);
+	if (0 != cline)
+		ctext[ctextUsed++] = '\n';
+	else
+		cline = lineno;
+	memcpy(ctext + ctextUsed, s, n);
+	ctextUsed += n;
+}
+
+/*
+ * The comment in ctext has ended. Hand it to texthook whole, or print
+ * each of its lines for -c if the whole contains the -e pattern or there
+ * is none.
+ */
+static void
+comtext(void)
+{
+	char *s, *e;
+	int line;
+
+	if (0 == cline)
+		return;
+	if (NULL != texthook)
+		(*texthook)(ctext, ctextUsed, 'c');
+	else if (cswitch && (NULL == tpat ||
+	    regnexec(tpat, ctext, ctextUsed))) {
+		ctext[ctextUsed] = '\0';
+		for (s = ctext, line = cline; ; s = e + 1, line++) {
+			if (NULL != (e = strchr(s, '\n')))
+				*e = '\0';
+			texthit(s, line);
+			if (NULL == e)
+				break;
+			*e = '\n';
+		}
+	}
+	cline = 0;
+	ctextUsed = 0;
+}
+
+/*
+ * Print a hit found before at line of filen, as lex() would have.
+ */
+void
+printhit(const char *s, int line)
+{
+	if (lswitch)
+		printname();
+	else {
+		lineno = line;
+		printx((char *)s);
+	}
+}
+
+/*
+ * Print the given lines of filen, which must be in order, as if they
+ * had been found by lex(). For hits known without lexing the file.
+ */
+void
+printlines(const uint32_t *lines, size_t n)
+{
+	const char *p, *q, *end;
+	size_t k;
+	int i;
+
+	if (lswitch && NULL != hithook)
+		(*hithook)("", lines[0]);
+	else if (lswitch)
+		printname();
+	if (lswitch)
+		return;
+	if (-1 == mapin()) {
 		fprintf(stderr, "cgrep: warning cannot open %s\n", filen);
 		return;
 	}
 
-	if (rswitch) {
-		changed = 0;	/* no changes so far */
+	end = ibuf + ibufLen;
+	for (p = ibuf, lineno = 1, k = 0; k < n && p < end; lineno++) {
+		if (NULL == (q = memchr(p, '\n', end - p)))
+			q = end;
+		if (lines[k] == (uint32_t)lineno &&
+		    NULL == hithook && !aswitch) {
+			printref(p, q - p);
+			k++;
+		}
+		else if (lines[k] == (uint32_t)lineno) {
+			i = q - p;
+			ROOM(line, lineLen, i);
+			memcpy(line, p, i);
+			line[i] = '\0';
+			printx(line);
+			k++;
+		}
+		p = q + 1;
+	}
+	unmapin();
+}
+
+/*
+ * Write the input to stdout with the edits made, the unchanged runs
+ * straight from the input.
+ */
+static void
+replaced(void)
+{
+	size_t from = 0;
+	int k;
+
+	for (k = 0; k < nedit; k++) {
+		oref(ibuf + from, edits[k].off - from);
+		owrite(subs + edits[k].to, edits[k].tolen);
+		from = edits[k].off + edits[k].len;
+	}
+	oref(ibuf + from, ibufLen - from);
+}
+
+/*
+ * Copy the n bytes at off in the input, fd, to ofd: on Linux with
+ * copy_file_range(2), so the file system can share the blocks rather
+ * than move the bytes, otherwise from the input buffer.
+ */
+static int
+copyrun(int fd, int ofd, size_t off, size_t n)
+{
+	ssize_t k;
+#ifdef __linux__
+	loff_t o = off;
 
-		if (NULL == filen)
-			tfp = stdout;
-		else if ((NULL == (tname = tempnam(NULL, "cse"))) ||
-			 (NULL == (tfp = fopen(tname, "w"))))
-		  	fatal("csed: Cannot open tmp file");
+	while (n > 0 && 0 < (k = copy_file_range(fd, &o, ofd, NULL, n, 0)))
+		n -= k;
+	off = o;
+#endif
+	for (; n > 0; off += k, n -= k)
+		if (0 >= (k = write(ofd, ibuf + off, n)))
+			return -1;
+	return 0;
+}
+
+/*
+ * Replace filen with the input with the edits made. The new file is
+ * put together beside it, unchanged runs copied from the old file and
+ * the replacements written, then renamed over it.
+ */
+static void
+rewrite(void)
+{
+	struct stat st;
+	size_t from = 0, n;
+	char *tmp;
+	int fd, ofd, k, bad = 0;
+
+	if (-1 == asprintf(&tmp, "%s.XXXXXX", filen))
+		fatal(outSpace);
+	if (-1 == (fd = open(filen, O_RDONLY)) || -1 == fstat(fd, &st) ||
+	    -1 == (ofd = mkstemp(tmp)))
+		fatal("%s: cannot rewrite %s\n", getprogname(), filen);
+	for (k = 0; k < nedit && !bad; k++) {
+		n = edits[k].tolen;
+		bad = -1 == copyrun(fd, ofd, from, edits[k].off - from) ||
+		    (ssize_t)n != write(ofd, subs + edits[k].to, n);
+		from = edits[k].off + edits[k].len;
+	}
+	if (bad || -1 == copyrun(fd, ofd, from, ibufLen - from) ||
+	    -1 == fchmod(ofd, st.st_mode & 07777) || -1 == close(ofd) ||
+	    -1 == rename(tmp, filen)) {
+		unlink(tmp);
+		fatal("%s: cannot rewrite %s\n", getprogname(), filen);
 	}
+	close(fd);
+	free(tmp);
+}
 
-	lineno = 1;
+/*
+ * Whether lex() can resume at the start of a line in state.
+ */
+int
+lexresumes(int state)
+{
+	return start == state || (comment == state && !cswitch);
+}
+
+/*
+ * Lexically process a file.
+ */
+void
+lex()
+{
+	int  c, i;
+	enum fstate state, pstate = start;
+	char *w;
+	const char *p, *q, *ws = NULL, *end;	/* input pointers, word start */
+
+	if (-1 == mapin()) {
+		fprintf(stderr, "cgrep: warning cannot open %s\n", filen);
+		return;
+	}
+	end = ibuf + ibufLen;
+
+	nedit = 0;		/* no changes so far */
+	subsUsed = 0;
+	cline = 0;		/* in no comment */
+	ctextUsed = 0;
+	if (qswitch)
+		qstart();
+
+	p = ibuf + lexfrom.off;	/* the start, or as ckhook was told */
+	bol = lexfrom.off;
+	lineno = lexfrom.line;
+	state = lexfrom.state;
+	lexfrom.off = 0;
+	lexfrom.line = 1;
+	lexfrom.state = start;
+	w = line;
 	i = marked = 0;
-	gota(other, NULL);	/* initialize word machine */
-	for (state = start; ; ) {
+	gota(other, NULL, 0);	/* initialize word machine */
+	for (; ; ) {
 		line[i] = '\0';
-		c = fgetc(ifp);
+		q = p;
+		c = (p < end) ? (unsigned char)*p++ : EOF;
 
 		switch (state) {
 		case minus:
+			if (NULL != tokhook)
+				(*tokhook)('-', q - 1, 1, lineno);
 			if ('>' == c) {
-				gota(dot, "->");
+				if (NULL != tokhook)
+					(*tokhook)(c, q, 1, lineno);
+				gota(dot, "->", 2);
 				state = start;
 				break;
 			}
@@ -425,20 +1346,25 @@ lex()
 		case token:
 			if (isalnum(c) || c == '_')
 				break;
-			gota(word, w);
+			if (NULL != tokhook)
+				(*tokhook)(0, ws, q - ws, lineno);
+			gota(word, ws, q - ws);
 
 			/* we have a word to replace */
 			if (rswitch && marked) {
-				i += strlen(newstr) - strlen(w);
-				ROOM(line, lineLen, i);
-				strcpy(w, newstr);
-				changed = 1;
+				TROOM(edits, editsLen, nedit);
+				edits[nedit].off = ws - ibuf;
+				edits[nedit].len = q - ws;
+				edits[nedit].to = rento;
+				edits[nedit++].tolen = rentoLen;
 			}
 isstart:		state = start;
 		case start:
 			switch (c) {
 			case '.':
-				gota(dot, ".");
+				if (NULL != tokhook)
+					(*tokhook)(c, q, 1, lineno);
+				gota(dot, ".", 1);
 				break;
 			case '-':
 				state = minus;
@@ -447,6 +1373,8 @@ isstart:		state = start;
 				state = slash;
 				break;
 			case '\\':
+				if (NULL != tokhook)
+					(*tokhook)(c, q, 1, lineno);
 				pstate = state;
 				state = bsl;
 				break;
@@ -460,24 +1388,32 @@ isstart:		state = start;
 			default:
 				if (isalpha(c)) {
 					w = line + i;
+					ws = q;
 					state = token;
 				}
-				else if (!isspace(c))
-					gota(other, NULL);
+				else if (!isspace(c)) {
+					if (NULL != tokhook && EOF != c)
+						(*tokhook)(c, q, 1, lineno);
+					gota(other, NULL, 0);
+				}
 			}
 			break;
 		case slash:
-			if ('*' != c)
+			if ('*' != c) {
+				if (NULL != tokhook)
+					(*tokhook)('/', q - 1, 1, lineno);
 				goto isstart;
+			}
 			w = line + i + 1;
 			state = comment;
 			break;
 		case star:
 			if ('/' == c) {
-				if (cswitch) { /* report comment */
+				if (cswitch || texthook) { /* report comment */
 					line[i - 1] = '\0';
-					printx(w);
+					comadd(w);
 					line[i - 1] = '*';
+					comtext();
 				}
 				state = start;
 				break;
@@ -495,10 +1431,8 @@ isstart:		state = start;
 			case '"':
 			case '\n':
 				state = start;
-				if (sswitch)
-					printx(w + 1);
-				else
-					gota(other, NULL);
+				strtext(w + 1);
+				gota(other, NULL, 0);
 				break;
 			case '\\':
 				pstate = state;
@@ -510,7 +1444,7 @@ isstart:		state = start;
 			switch (c) {
 			case '\'':
 			case '\n':
-				gota(other, NULL);
+				gota(other, NULL, 0);
 				state = start;
 				break;
 			case '\\':
@@ -525,73 +1459,216 @@ isstart:		state = start;
 			ROOM(line, lineLen, i);
 		}
 		else {	/* end of line */
-			if (rswitch) {
-				if (EOF == c) {
-					if (!i) /* null line */
-						break;
-				}
-				else
-					line[i++] = c;
-				ROOM(line, lineLen, i);
-				line[i] = 0;
-				fputs(line, tfp);
+			if (rswitch)
 				marked = 0;
-			}
 
-			if (cswitch && (comment == state)) {
-				printx(w);
+			if ((cswitch || texthook) && (comment == state)) {
+				comadd(w);
 				w = line;
+				if (EOF == c)	/* never closed */
+					comtext();
 			}
 
 			if (marked) {
 				marked = 0;			
+				if (lswitch && NULL != hithook) {
+					(*hithook)(line, lineno);
+					break;
+				}
 				if (lswitch) {
-					printf("%s\n", filen);
+					printname();
 					break;
 				}
-				printx(line);
+				if (NULL == hithook && !aswitch &&
+				    (size_t)i == (size_t)(q - ibuf) - bol)
+					printref(ibuf + bol, i);
+				else
+					printx(line);
 			}
 
 			lineno++;
+			bol = p - ibuf;
 			i = 0;
 			if (EOF == c)
 				break;
+			if (qswitch && -1 != qresult(0))
+				break;	/* the query is decided */
+			if (NULL != ckhook && other == chain &&
+			    lexresumes(state) &&
+			    (*ckhook)(p - ibuf, lineno, state))
+				break;
 		}
 	}
 
-	fclose(ifp);
+	if (qswitch && 1 == qresult(1))
+		printname();
+	if (NULL != tokhook)
+		(*tokhook)(EOF, ibuf, ibufLen, lineno);
+	if (rswitch && NULL == filen)
+		replaced();	/* stdin goes out changed */
+	else if (rswitch && 0 != nedit)
+		rewrite();
+	unmapin();
 
-	if (rswitch) {
-		fclose(tfp);
-
-		if (NULL == filen)
-			; /* do nothing file is already out */
-		else if (changed) {
-			unlink(filen);
-			sprintf(line, "mv %s %s", tname, filen);
-			system(line);
-		}
-		else
-			unlink(tname);
-	}
+	if (NULL != qfp)	/* the file's hits for the editor */
+		fflush(qfp);
 
 	if (aswitch && (NULL != tname)) /* tmp file opened for -A option */
 		callEmacs();
 }
 
+/*
+ * Refuse any archive among the n files named, for opt, which searches
+ * files only as they are.
+ */
+static void
+noarchive(int n, char **names, const char *opt)
+{
+	for (; n > 0; n--, names++)
+		if (tarname(*names))
+			fatal("%s: %s cannot search archive %s\n",
+			    getprogname(), opt, *names);
+}
+
+/*
+ * Add each line of file to the pattern set.
+ */
+static void
+patfile(const char *file)
+{
+	FILE *fp;
+	char *p = NULL;
+	size_t has = 0;
+	ssize_t n;
+
+	if (NULL == (fp = fopen(file, "r")))
+		fatal("%s: cannot open %s\n", getprogname(), file);
+	while (-1 != (n = getline(&p, &has, fp))) {
+		if (n && '\n' == p[n - 1])
+			p[--n] = '\0';
+		if (n)
+			psadd(pats, p);
+	}
+	free(p);
+	fclose(fp);
+}
+
+/*
+ * The patterns and the switches that change what is printed, spelled
+ * out, for keeping results of this search to be found again.
+ */
+static char *
+querykey(int fuzzyk, const char *fuzzsrc)
+{
+	char *key;
+
+	if (-1 == asprintf(&key, "l%d n%d s%d c%d fuzzy %d %s sum %08x e %s",
+	    lswitch, nswitch, sswitch, cswitch, fuzzyk,
+	    (NULL != fuzzsrc) ? fuzzsrc : "",
+	    (NULL != fuzz || sswitch || cswitch) ? 0 : pssum(pats),
+	    (NULL != tpatsrc) ? tpatsrc : ""))
+		fatal(outSpace);
+	return key;
+}
+
+enum {		/* long only options */
+	OPT_COMPILE = CHAR_MAX + 1,
+	OPT_PATTERNS,
+	OPT_VERBOSE,
+	OPT_FUZZY,
+	OPT_INDEX,
+	OPT_SERVE,
+	OPT_CONNECT,
+	OPT_WATCH,
+	OPT_CACHE,
+	OPT_CACHESIZE,
+	OPT_RESULTS,
+	OPT_CHECKPOINTS,
+	OPT_TAGS,
+	OPT_JOBS,
+	OPT_GIT,
+	OPT_CHANGED,
+	OPT_REV,
+	OPT_INCLUDE,
+	OPT_EXCLUDE,
+	OPT_JSON,
+	OPT_NULL,
+	OPT_QUICKFIX,
+	OPT_RENAMEMAP,
+	OPT_QUERY,
+	OPT_TOKENS
+};
+
+static const struct option longopts[] = {
+	{ "compile-patterns",	required_argument,	NULL,	OPT_COMPILE },
+	{ "patterns",		required_argument,	NULL,	OPT_PATTERNS },
+	{ "verbose",		no_argument,		NULL,	OPT_VERBOSE },
+	{ "fuzzy",		required_argument,	NULL,	OPT_FUZZY },
+	{ "index",		required_argument,	NULL,	OPT_INDEX },
+	{ "serve",		required_argument,	NULL,	OPT_SERVE },
+	{ "connect",		required_argument,	NULL,	OPT_CONNECT },
+	{ "watch",		no_argument,		NULL,	OPT_WATCH },
+	{ "cache",		required_argument,	NULL,	OPT_CACHE },
+	{ "cache-size",		required_argument,	NULL,	OPT_CACHESIZE },
+	{ "results",		required_argument,	NULL,	OPT_RESULTS },
+	{ "checkpoints",	required_argument,	NULL,	OPT_CHECKPOINTS },
+	{ "tags",		required_argument,	NULL,	OPT_TAGS },
+	{ "jobs",		required_argument,	NULL,	OPT_JOBS },
+	{ "git",		no_argument,		NULL,	OPT_GIT },
+	{ "changed-since",	required_argument,	NULL,	OPT_CHANGED },
+	{ "rev",		required_argument,	NULL,	OPT_REV },
+	{ "include",		required_argument,	NULL,	OPT_INCLUDE },
+	{ "exclude",		required_argument,	NULL,	OPT_EXCLUDE },
+	{ "json",		no_argument,		NULL,	OPT_JSON },
+	{ "null",		no_argument,		NULL,	OPT_NULL },
+	{ "quickfix",		required_argument,	NULL,	OPT_QUICKFIX },
+	{ "rename-map",		required_argument,	NULL,	OPT_RENAMEMAP },
+	{ "query",		required_argument,	NULL,	OPT_QUERY },
+	{ "tokens",		required_argument,	NULL,	OPT_TOKENS },
+	{ NULL,			0,			NULL,	0 }
+};
+
+/*
+ * Run cgrep with the given arguments, for main() or for each query to a
+ * --serve daemon.
+ */
 int
-main(int argc, char **argv)
+cgrep(int argc, char **argv)
 {
-	char c;
+	int c;
 	int errsw = 0;
-	char *p, *q;
-
-	setprogname(argv[0]);
+	char *cgpout = NULL;	/* --compile-patterns file */
+	char *cgpin = NULL;	/* --patterns file */
+	int fuzzyk = -1;	/* --fuzzy distance */
+	char ixmode = 0;	/* --index 'b'uild or 'q'uery */
+	char **epats = NULL;	/* -e patterns */
+	int nepat = 0, epatLen = 0, i;
+	size_t n;
+	char *sock = NULL;	/* --serve or --connect socket */
+	char sockmode = 0;	/* 's'erve or 'c'onnect */
+	char wswitch = 0;	/* --watch */
+	char *fuzzsrc = NULL;	/* --fuzzy literal */
+	char *qfname = NULL;	/* --quickfix list */
+	char *end;
+	long k;
+	struct stat st;
+	char gswitch = 0;	/* --git */
+	char *since = NULL;	/* --changed-since revision */
+	char **revs = NULL;	/* --rev revisions */
+	int nrev = 0, revsLen = 0;
 
 	if (1 == argc)
 		usage();
 
-	while (-1 != (c = getopt(argc, argv, "cslnA?r:"))) {
+#ifdef __GLIBC__
+	optind = 0;
+#else
+	optreset = 1;
+	optind = 1;
+#endif
+	pats = psnew();
+	while (-1 != (c = getopt_long(argc, argv, "cslnA?r:e:f:", longopts,
+	    NULL))) {
 		switch (c) {
 		case 'c':
 			cswitch = 1;	/* comments only */
@@ -609,43 +1686,346 @@ main(int argc, char **argv)
 			aswitch = 1;	/* interact with emacs */
 			break;
 		case 'r':
+			if (NULL != renames)
+				errsw = 1;
 			rswitch = 1;	/* replace hits */
 			newstr = optarg;
+			for (nsub = 0, i = 0; '\0' != newstr[i]; i++)
+				if ('\\' == newstr[i] && newstr[i + 1] >= '0' &&
+				    newstr[i + 1] <= '9')
+					nsub++;
+				else if ('\\' == newstr[i] &&
+				    '\\' == newstr[i + 1])
+					i++;	/* \\1 is no group */
+			break;
+		case 'e':
+			TROOM(epats, epatLen, nepat);
+			epats[nepat++] = optarg;	/* explicit pattern */
+			break;
+		case 'f':
+			patfile(optarg);	/* patterns from file */
+			pfswitch = 1;
+			break;
+		case OPT_COMPILE:
+			cgpout = optarg;	/* save compiled patterns */
+			break;
+		case OPT_PATTERNS:
+			cgpin = optarg;		/* load compiled patterns */
+			break;
+		case OPT_VERBOSE:
+			verbose = 1;		/* report decisions */
+			break;
+		case OPT_FUZZY:
+			k = strtol(optarg, &end, 10);	/* approximate match */
+			if ('\0' == *optarg || '\0' != *end || k < 0 ||
+			    k > INT_MAX)
+				fatal("%s: bad --fuzzy distance %s\n",
+				    getprogname(), optarg);
+			fuzzyk = k;
+			break;
+		case OPT_INDEX:
+			if (!strcmp(optarg, "build"))
+				ixmode = 'b';	/* write indexes */
+			else if (!strcmp(optarg, "query"))
+				ixmode = 'q';	/* search with them */
+			else
+				errsw = 1;
+			break;
+		case OPT_SERVE:
+		case OPT_CONNECT:
+			sock = optarg;		/* daemon socket */
+			sockmode = (OPT_SERVE == c) ? 's' : 'c';
+			break;
+		case OPT_WATCH:
+			wswitch = 1;		/* keep searching */
+			break;
+		case OPT_CACHE:
+			cachedir = optarg;	/* lexed files kept here */
+			break;
+		case OPT_CACHESIZE:
+			k = strtol(optarg, &end, 10);	/* megabytes */
+			if ('\0' == *optarg || '\0' != *end || k < 1 ||
+			    (unsigned long)k > SIZE_MAX >> 20)
+				errsw = 1;
+			else
+				cachecap = k;
+			break;
+		case OPT_RESULTS:
+			resdir = optarg;	/* hits kept here */
+			break;
+		case OPT_CHECKPOINTS:
+			ckfile = optarg;	/* lexer states kept here */
+			break;
+		case OPT_TAGS:
+			tagfile = optarg;	/* write definitions */
+			break;
+		case OPT_JOBS:
+			k = strtol(optarg, &end, 10);	/* workers for --tags */
+			if ('\0' == *optarg || '\0' != *end || k < 1 ||
+			    k > INT_MAX)
+				errsw = 1;
+			else
+				tagjobs = k;
+			break;
+		case OPT_GIT:
+			gswitch = 1;		/* files from the index */
+			break;
+		case OPT_CHANGED:
+			gswitch = 1;		/* just those changed */
+			since = optarg;
+			break;
+		case OPT_REV:
+			TROOM(revs, revsLen, nrev);
+			revs[nrev++] = optarg;	/* search the repository */
+			break;
+		case OPT_INCLUDE:
+		case OPT_EXCLUDE:
+			addglob(optarg, OPT_INCLUDE == c);	/* which files */
+			break;
+		case OPT_JSON:
+			oformat = 'j';		/* hits as JSON */
+			break;
+		case OPT_NULL:
+			oformat = '0';		/* hits as NUL ended fields */
+			break;
+		case OPT_QUICKFIX:
+			qfname = optarg;	/* hits listed here */
+			break;
+		case OPT_RENAMEMAP:
+			if (rswitch)
+				errsw = 1;	/* one or the other */
+			rswitch = 1;
+			renmap(optarg);		/* replace hits by name */
+			break;
+		case OPT_QUERY:
+			qswitch = 1;		/* files the query is true of */
+			qcomp(optarg);
+			slicehook = qslice;
+			break;
+		case OPT_TOKENS:
+			tswitch = 1;		/* token sequences */
+			tscomp(optarg);
+			tokhook = seqtok;
 			break;
 		default:
 			errsw = 1;
 		}
 	}
 
+	if ('c' == sockmode && !served)	/* let the daemon do it */
+		return client(sock, argc, argv);
+
 	/* check unknown switches and rswitch goes with no other switches */
 	if (errsw || 
-	    (rswitch && (aswitch | nswitch | lswitch | cswitch | sswitch)))
+	    (rswitch && (aswitch | nswitch | lswitch | cswitch | sswitch)) ||
+	    (NULL != renames && (pfswitch | nepat | ixmode | sockmode |
+	    served | wswitch | nrev | (-1 != fuzzyk) | (NULL != cgpin) |
+	    (NULL != cgpout))) ||
+	    (cgpin && (pfswitch || cgpout)) ||
+	    (-1 != fuzzyk && (cgpin || pfswitch || cgpout)) ||
+	    (ixmode && (aswitch | rswitch)) ||
+	    ('b' == ixmode && (cswitch | sswitch | nepat)) ||
+	    ('s' == sockmode && (lswitch | nswitch | sswitch | cswitch |
+	    aswitch | rswitch | pfswitch | nepat | ixmode | (-1 != fuzzyk) |
+	    (NULL != cgpin) | (NULL != cgpout))) ||
+	    (served && (aswitch | rswitch | ixmode | (NULL != cgpout))) ||
+	    (wswitch && (aswitch | rswitch | ixmode | sockmode |
+	    (NULL != cgpout))) ||
+	    (cachedir && (aswitch | rswitch | sswitch | cswitch | ixmode |
+	    sockmode | wswitch)) ||
+	    (resdir && (aswitch | rswitch | ixmode | sockmode | wswitch)) ||
+	    (ckfile && (aswitch | rswitch | lswitch | ixmode | sockmode |
+	    wswitch | (NULL != resdir) | (NULL != cachedir))) ||
+	    (tagfile && (aswitch | rswitch | lswitch | sswitch | cswitch |
+	    ixmode | sockmode | wswitch | (NULL != resdir) |
+	    (NULL != cachedir) | (NULL != ckfile) | (NULL != cgpout))) ||
+	    (gswitch && (ixmode | sockmode | served | (NULL != cgpout))) ||
+	    (nrev && (aswitch | rswitch | ixmode | sockmode | served | wswitch |
+	    gswitch | (NULL != cachedir) | (NULL != resdir) |
+	    (NULL != ckfile) | (NULL != tagfile) | (NULL != cgpout))) ||
+	    (oformat && (aswitch | rswitch | sswitch | cswitch | ixmode |
+	    sockmode | served | wswitch | nrev | (NULL != cachedir) |
+	    (NULL != resdir) | (NULL != ckfile) | (NULL != cgpout))) ||
+	    (qfname && (aswitch | rswitch | sswitch | cswitch | lswitch |
+	    oformat | ixmode | sockmode | served | wswitch | nrev |
+	    (NULL != cachedir) | (NULL != resdir) | (NULL != ckfile) |
+	    (NULL != tagfile) | (NULL != cgpout))) ||
+	    (qswitch && (aswitch | rswitch | sswitch | cswitch | nswitch |
+	    pfswitch | nepat | ixmode | sockmode | served | wswitch | nrev |
+	    (-1 != fuzzyk) | (NULL != qfname) | (NULL != cgpin) |
+	    (NULL != cgpout) | (NULL != cachedir) | (NULL != resdir) |
+	    (NULL != ckfile) | (NULL != tagfile))) ||
+	    (tswitch && (aswitch | rswitch | sswitch | cswitch | pfswitch |
+	    nepat | oformat | qswitch | ixmode | sockmode | served | wswitch |
+	    nrev | (-1 != fuzzyk) | (NULL != qfname) | (NULL != cgpin) |
+	    (NULL != cgpout) | (NULL != cachedir) | (NULL != resdir) |
+	    (NULL != ckfile) | (NULL != tagfile))))
 		usage();
 
-	if (!sswitch && !cswitch) {	/* process pattern */
-		if (optind == argc)		/* no pattern */
+	ROOM(line, lineLen, 1);	/* get input line started */
+
+	if (NULL != qfname) {	/* a FIFO waits for its reader here */
+		if (NULL == (qfp = fopen(qfname, "w")))
+			fatal("%s: cannot write %s\n", getprogname(), qfname);
+		if (-1 != fstat(fileno(qfp), &st) && S_ISFIFO(st.st_mode))
+			setvbuf(qfp, NULL, _IOLBF, 0);
+	}
+
+	if ('s' == sockmode) {	/* no pattern, just what to hold */
+		if (optind == argc)
+			usage();
+		noarchive(argc - optind, argv + optind, "--serve");
+		serve(sock, argc - optind, argv + optind);
+	}
+
+	if ('b' == ixmode) {	/* no pattern, just directories */
+		if (optind == argc)
 			usage();
+		noarchive(argc - optind, argv + optind, "--index");
+		while (optind < argc)
+			ixbuild(argv[optind++]);
+		return 0;
+	}
 
-		/* inclose pattern in ^(  )$ to force full match */
-		p = alloc(5 + strlen(q = argv[optind++]));
-		sprintf(p, "^(%s)$", q);
-		if (NULL == (pat = regcomp(p)))
-			fatal("Illegal pattern\n");
+	if (-1 != fuzzyk) {		/* literal within fuzzyk edits */
+		if (sswitch || cswitch || optind == argc)
+			usage();
+		fuzzsrc = argv[optind++];
+		fuzz = fzcomp(fuzzsrc, fuzzyk);
+	}
+	else if (cgpin)			/* precompiled patterns */
+		pats = psload(cgpin);
+	else if (sswitch || cswitch) {	/* search strings or comments */
+		if (nepat) {
+			for (n = 0, i = 0; i < nepat; i++)
+				n += strlen(epats[i]) + 1;
+			tpatsrc = alloc(n);
+			for (i = 0; i < nepat; i++) {
+				if (i)
+					strcat(tpatsrc, "|");
+				strcat(tpatsrc, epats[i]);
+			}
+			if (NULL == (tpat = regcomp(tpatsrc)))
+				fatal("Illegal pattern\n");
+		}
+	}
+	else {				/* process pattern */
+		for (i = 0; i < nepat; i++)
+			psadd(pats, epats[i]);
+		if (!pfswitch && !nepat && NULL == tagfile &&
+		    NULL == renames && !qswitch && !tswitch) {
+			if (optind == argc)	/* no pattern */
+				usage();
+			psadd(pats, argv[optind++]);
+		}
+		psfreeze(pats);
 	}
 
-	ROOM(line, lineLen, 1);	/* get input line started */
+	if (served && optind != argc)	/* files are the daemon's */
+		usage();
+
+	if (cgpout) {		/* just save the patterns */
+		pswrite(pats, cgpout);
+		return 0;
+	}
 
-	if (optind == argc) {
+	if (ixmode) {		/* directories with indexes */
+		if (optind == argc)
+			usage();
+		noarchive(argc - optind, argv + optind, "--index");
+		while (optind < argc)
+			if (sswitch || cswitch)
+				ixtquery(argv[optind++], tpatsrc,
+				    sswitch | cswitch << 1);
+			else
+				ixquery(argv[optind++]);
+		return 0;
+	}
+
+	if (nrev) {		/* revisions in the repository */
+		if (optind != argc)
+			usage();
+		for (i = 0; i < nrev; i++)
+			gitsearch(revs[i]);
+		return 0;
+	}
+
+	if (gswitch) {		/* the files git tracks */
+		if (optind != argc)
+			usage();
+		argv = gitfiles(since, &argc);
+		optind = 0;
+		if (0 == argc)
+			return 0;
+	}
+
+	if (wswitch) {		/* directories to keep searching */
+		if (optind == argc)
+			usage();
+		c = lswitch;
+		lswitch = 0;	/* watch() lists the files itself */
+		noarchive(argc - optind, argv + optind, "--watch");
+		watch(argc - optind, argv + optind, c, nswitch);
+	}
+
+	if (served)		/* the daemon's files */
+		srvsearch(sswitch | cswitch);
+	else if (NULL != tagfile) {	/* definitions too */
+		if (optind == argc)
+			usage();
+		noarchive(argc - optind, argv + optind, "--tags");
+		tagrun(argc - optind, argv + optind,
+		    NULL != fuzz || NULL != cgpin || pfswitch || nepat);
+	}
+	else if (NULL != ckfile) {	/* one file, searched before */
+		if (optind + 1 != argc)
+			usage();
+		noarchive(1, argv + optind, "--checkpoints");
+		filen = argv[optind];
+		cklex(querykey(fuzzyk, fuzzsrc));
+	}
+	else if (optind == argc) {
 		if (aswitch | lswitch)
 			fatal("-A and -l require a filename");
 		lex();
 	}
 	else {
+		if (NULL != resdir)	/* found before, perhaps */
+			resopen(querykey(fuzzyk, fuzzsrc));
+		if (NULL != cachedir &&	/* lexed before, perhaps */
+		    -1 == mkdir(cachedir, 0777) && EEXIST != errno)
+			fatal("%s: cannot make %s\n", getprogname(), cachedir);
 		while (optind < argc) {
 			filen = argv[optind++];
-			lex();
+			if (tarname(filen)) {	/* its members */
+				if (rswitch | aswitch)
+					fatal("%s: cannot change %s\n",
+					    getprogname(), filen);
+				tarlex();
+			}
+			else if (NULL != resdir)
+				reslex();
+			else if (NULL != cachedir)
+				cachelex();
+			else
+				lex();
 		}
+		if (NULL != cachedir)
+			cacheprune();
+		if (NULL != resdir)
+			resclose();
 	}
 
+	if (NULL != qfp && EOF == fclose(qfp))
+		fatal("%s: cannot write %s\n", getprogname(), qfname);
 	return 0;
 }
+
+int
+main(int argc, char **argv)
+{
+	setprogname(argv[0]);
+	atexit(oflush);
+
+	return cgrep(argc, argv);
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Declarations shared by the cgrep source files.
+ */
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Cgrep never runs out of room on lines or buffers until malloc fails
+ * these are buffer expanders.
+ */
+#define TROOM(buf, has, needs)	while ((size_t)(needs) >= (size_t)(has)) \
+ if (NULL == (buf = realloc(buf, sizeof(*buf) * (has += 10)))) \
+  fatal(outSpace)
+
+#define ROOM(buf, has, needs)	while ((size_t)(needs) >= (size_t)(has)) \
+ if (NULL == (buf = realloc(buf, has += 512))) \
+  fatal(outSpace)
+
+extern char outSpace[];
+extern char verbose;		/* report what cgrep decides */
+
+struct post {		/* a growing run of varints */
+	unsigned char *p;
+	size_t len, has;
+};
+
+struct lexpoint {	/* where lex() starts */
+	size_t off;		/* in the input */
+	int line;
+	int state;		/* lexer state */
+};
+
+struct walked {		/* a source found by walk() */
+	char *path;		/* as cgrep will name it */
+	char *rel;		/* within path, relative to the walked dir */
+	off_t size;
+	struct timespec mtim;
+};
+
+/* cache.c */
+extern const char *cachedir;
+extern size_t cachecap;
+void	cachelex(void);
+void	cacheprune(void);
+
+/* cgrep.c */
+extern char *filen;
+extern struct lexpoint lexfrom;
+extern int (*ckhook)(size_t, int, int);
+extern void (*tokhook)(int, const char *, size_t, int);
+extern char served;
+extern void (*slicehook)(const char *, size_t, int);
+extern void (*texthook)(const char *, size_t, int);
+extern void (*hithook)(const char *, int);
+void	*alloc(size_t);
+int	cgrep(int, char **);
+__dead void fatal(char *, ...);
+uint32_t fnv(const void *, size_t);
+void	lex(void);
+int	lexresumes(int);
+int	match(const char *, size_t);
+void	printhit(const char *, int);
+void	printlines(const uint32_t *, size_t);
+void	setinput(const char *, size_t);
+
+/* ckpt.c */
+extern const char *ckfile;
+void	cklex(const char *);
+
+/* fuzzy.c */
+struct fuzzy;
+struct fuzzy *fzcomp(const char *, int);
+int	fzmatch(const struct fuzzy *, const char *, size_t);
+
+/* git.c */
+#define GIT_COMMIT	1	/* object types */
+#define GIT_TREE	2
+#define GIT_BLOB	3
+#define GIT_TAG		4
+char	**gitfiles(const char *, int *);
+unsigned char *gitobj(const unsigned char *, int *, size_t *);
+void	gitrev(const char *, unsigned char *);
+void	gitsearch(const char *);
+
+/* index.c */
+uint32_t getv(const unsigned char **);
+void	ixbuild(const char *);
+void	ixquery(const char *);
+void	ixtquery(const char *, const char *, int);
+void	putv(struct post *, uint32_t);
+int	skipv(const unsigned char **, const unsigned char *);
+
+/* out.c */
+void	oflush(void);
+void	ojson(const char *, size_t);
+void	onum(long, int);
+void	oputs(const char *);
+void	oref(const void *, size_t);
+void	orelease(void);
+void	owrite(const void *, size_t);
+
+/* patset.c */
+struct patset;
+struct patset *psnew(void);
+void	psadd(struct patset *, const char *);
+void	psfreeze(struct patset *);
+int	psmatch(struct patset *, const char *, size_t);
+struct regexp *psfind(struct patset *, const char *, size_t);
+uint32_t pssum(const struct patset *);
+void	pswrite(const struct patset *, const char *);
+struct patset *psload(const char *);
+
+/* query.c */
+void	qcomp(const char *);
+int	qresult(int);
+void	qslice(const char *, size_t, int);
+void	qstart(void);
+
+/* results.c */
+extern const char *resdir;
+void	resopen(const char *);
+void	reslex(void);
+void	resclose(void);
+
+/* serve.c */
+__dead void serve(const char *, int, char **);
+int	client(const char *, int, char **);
+void	srvsearch(int);
+
+/* tokseq.c */
+void	tscomp(const char *);
+int	tsstep(int, const char *, size_t);
+
+/* tags.c */
+extern const char *tagfile;
+extern int tagjobs;
+void	tagrun(int, char **, int);
+
+/* tar.c */
+int	tarname(const char *);
+void	tarlex(void);
+
+/* walk.c */
+extern struct walked *files;
+extern size_t nfiles;
+extern void (*dirhook)(const char *);
+void	addglob(const char *, int);
+int	csource(const char *);
+void	walk(const char *);
+
+/* watch.c */
+__dead void watch(int, char **, int, int);
@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Lexer checkpoints.
+ *
+ * The state of lex() at the start of a line depends on everything
+ * before it, but only through a little: the lexer state, which is
+ * start or in a comment there, and the word machine, which is mostly
+ * between chains. With --checkpoints=file a search records, every
+ * CK_STEP bytes or so, the offset, line and state of such a line, a
+ * hash of the bytes up to the next checkpoint, and all its hits.
+ *
+ * Searching the file again, checkpoints are compared from the front
+ * until the bytes after one differ, and from the back, shifted by the
+ * change in size, until they differ again. Lexing resumes at the last
+ * checkpoint before the change. Once it reaches one of the unchanged
+ * tail's checkpoints in the same state, it would only do again what
+ * the old run did, so it stops and the old hits from there are reused
+ * with their lines renumbered. The file is laid out as:
+ *
+ *	struct ckhdr
+ *	the key, the patterns, switches and file in full
+ *	struct ckpt [nck]
+ *	hits, a varint line number then the NUL terminated text for each
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cgrep.h"
+
+#define CK_MAGIC	0x0a4b4743	/* "CGK\n" read as a native integer */
+#define CK_VERSION	2	/* 2: -s, -c decode strings, join comments */
+#define CK_STEP		4096		/* bytes between checkpoints */
+
+struct ckhdr {		/* start of a checkpoint file */
+	uint32_t magic;		/* CK_MAGIC, also catches byte order */
+	uint32_t version;	/* CK_VERSION */
+	uint32_t nck;		/* checkpoints */
+	uint32_t nhit;		/* hits */
+	uint32_t keylen;	/* bytes of key following */
+	uint32_t hlen;		/* bytes of hits */
+	uint64_t size;		/* of the file searched */
+	uint64_t len;		/* bytes in the whole file */
+};
+
+struct ckpt {		/* a line lex() can resume at */
+	uint64_t off;
+	uint32_t line;
+	uint32_t state;
+	uint32_t sum;		/* fnv() of the bytes to the next one */
+	uint32_t pad;
+};
+
+const char *ckfile;		/* --checkpoints */
+
+static struct ckpt *cks;	/* this run's checkpoints */
+static size_t nck, cksLen;
+static struct post hits;	/* and hits */
+static uint32_t nhit;
+
+static const struct ckpt *ock;	/* the old run's */
+static uint32_t nock;
+static size_t want;		/* next of them to converge on */
+static int64_t delta;		/* change in size */
+static long cvg = -1;		/* the one converged on */
+static int cvgline;		/* and its line now */
+
+/*
+ * The hithook: keep a hit.
+ */
+static void
+ckhit(const char *s, int line)
+{
+	size_t n = strlen(s) + 1;
+
+	putv(&hits, line);
+	ROOM(hits.p, hits.has, hits.len + n);
+	memcpy(hits.p + hits.len, s, n);
+	hits.len += n;
+	nhit++;
+}
+
+/*
+ * Copy the n old hits at p, with lines from first on, renumbered by dl.
+ * Returns the first byte after those copied.
+ */
+static const unsigned char *
+ckcopy(const unsigned char *p, uint32_t n, int first, int last, int dl)
+{
+	const unsigned char *q;
+	int line;
+
+	for (; n > 0; n--) {
+		q = p;
+		line = getv(&p);
+		if (line >= last) {
+			p = q;
+			break;
+		}
+		if (line >= first)
+			ckhit((const char *)p, line + dl);
+		p += strlen((const char *)p) + 1;
+	}
+	return p;
+}
+
+static void
+ckadd(size_t off, int line, int state)
+{
+	TROOM(cks, cksLen, nck);
+	memset(&cks[nck], 0, sizeof(*cks));
+	cks[nck].off = off;
+	cks[nck].line = line;
+	cks[nck].state = state;
+	nck++;
+}
+
+/*
+ * The ckhook: a line lex() could resume at. Stop if the old run was
+ * here in the same state, otherwise make it a checkpoint if it is far
+ * enough from the last.
+ */
+static int
+ckline(size_t off, int line, int state)
+{
+	while (want < nock && (int64_t)ock[want].off + delta < (int64_t)off)
+		want++;
+	if (want < nock && (int64_t)ock[want].off + delta == (int64_t)off &&
+	    ock[want].state == (uint32_t)state) {
+		cvg = want;
+		cvgline = line;
+		return 1;
+	}
+	if (off - cks[nck - 1].off >= CK_STEP)
+		ckadd(off, line, state);
+	return 0;
+}
+
+/*
+ * Write this run's checkpoints and hits for a file of size bytes.
+ */
+static void
+ckwrite(const char *key, const char *buf, size_t size)
+{
+	struct ckhdr h;
+	size_t i, end;
+	char *tmp;
+	FILE *fp;
+	int bad;
+
+	for (i = 0; i < nck; i++) {
+		end = (i + 1 < nck) ? cks[i + 1].off : size;
+		cks[i].sum = fnv(buf + cks[i].off, end - cks[i].off);
+	}
+
+	memset(&h, 0, sizeof(h));
+	h.magic = CK_MAGIC;
+	h.version = CK_VERSION;
+	h.nck = nck;
+	h.nhit = nhit;
+	h.keylen = strlen(key);
+	h.hlen = hits.len;
+	h.size = size;
+	h.len = sizeof(h) + ((h.keylen + 7) & ~7) + sizeof(*cks) * nck +
+	    hits.len;
+
+	if (-1 == asprintf(&tmp, "%s.%ld", ckfile, (long)getpid()))
+		fatal(outSpace);
+	if (NULL == (fp = fopen(tmp, "w")))
+		fatal("%s: cannot write %s\n", getprogname(), tmp);
+	fwrite(&h, sizeof(h), 1, fp);
+	fwrite(key, 1, h.keylen, fp);
+	fwrite("\0\0\0\0\0\0\0", 1, ((h.keylen + 7) & ~7) - h.keylen, fp);
+	fwrite(cks, sizeof(*cks), nck, fp);
+	fwrite(hits.p, 1, hits.len, fp);
+	bad = ferror(fp);
+	if (EOF == fclose(fp) || bad || -1 == rename(tmp, ckfile)) {
+		unlink(tmp);
+		fatal("%s: cannot write %s\n", getprogname(), ckfile);
+	}
+	free(tmp);
+}
+
+/*
+ * Whether h's checkpoints are in order within the size of the file they
+ * were made for, in states lex() can resume in, and its hits are nhit
+ * lines that fill hlen bytes.
+ */
+static int
+ckcheck(const struct ckhdr *h)
+{
+	const struct ckpt *ck;
+	const unsigned char *p, *q, *end;
+	uint32_t i;
+
+	ck = (const struct ckpt *)((const char *)(h + 1) +
+	    ((h->keylen + 7) & ~7));
+	for (i = 0; i < h->nck; i++)
+		if (ck[i].off > ((i + 1 < h->nck) ? ck[i + 1].off : h->size) ||
+		    !lexresumes(ck[i].state))
+			return 0;
+	p = (const unsigned char *)(ck + h->nck);
+	end = p + h->hlen;
+	for (i = 0; i < h->nhit; i++) {
+		if (!skipv(&p, end) || NULL == (q = memchr(p, '\0', end - p)))
+			return 0;
+		p = q + 1;
+	}
+	return p == end;
+}
+
+/*
+ * Map in the checkpoint file if it is one for key, or return NULL.
+ */
+static const struct ckhdr *
+ckopen(const char *key, size_t *lenp)
+{
+	const struct ckhdr *h;
+	struct stat st;
+	char *img;
+	int fd;
+
+	if (-1 == (fd = open(ckfile, O_RDONLY)))
+		return NULL;
+	img = MAP_FAILED;
+	if (-1 != fstat(fd, &st) && (size_t)st.st_size >= sizeof(*h))
+		img = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == img)
+		return NULL;
+
+	h = (const struct ckhdr *)img;
+	if (CK_MAGIC != h->magic || CK_VERSION != h->version ||
+	    h->len != (uint64_t)st.st_size || h->keylen != strlen(key) ||
+	    memcmp(h + 1, key, h->keylen) || 0 == h->nck ||
+	    h->len != sizeof(*h) + ((h->keylen + 7) & ~7) +
+	    sizeof(struct ckpt) * (uint64_t)h->nck + h->hlen ||
+	    !ckcheck(h)) {
+		munmap(img, st.st_size);
+		return NULL;
+	}
+	*lenp = st.st_size;
+	return h;
+}
+
+/*
+ * Search filen, lexing only what changed since the run that wrote
+ * ckfile, if it was one for key, the patterns and switches.
+ */
+void
+cklex(const char *k)
+{
+	const struct ckhdr *h = NULL;
+	const unsigned char *oh = NULL, *p;
+	struct stat st;
+	char *key, *buf = NULL;
+	size_t size, hlen = 0, end;
+	uint32_t a = 0, b, i;
+	int fd;
+
+	if (-1 == asprintf(&key, "%s file %s", k, filen))
+		fatal(outSpace);
+	if ((-1 == (fd = open(filen, O_RDONLY))) || (-1 == fstat(fd, &st)))
+		fatal("%s: cannot open %s\n", getprogname(), filen);
+	size = st.st_size;
+	if (size > 0 && MAP_FAILED == (buf = mmap(NULL, size, PROT_READ,
+	    MAP_PRIVATE, fd, 0)))
+		fatal("%s: cannot map %s\n", getprogname(), filen);
+	close(fd);
+
+	if (NULL != (h = ckopen(key, &hlen))) {
+		ock = (const struct ckpt *)((const char *)(h + 1) +
+		    ((h->keylen + 7) & ~7));
+		nock = h->nck;
+		oh = (const unsigned char *)(ock + nock);
+		delta = (int64_t)size - (int64_t)h->size;
+
+		/* the same from the front */
+		for (a = 0; a < nock; a++) {
+			end = (a + 1 < nock) ? ock[a + 1].off : h->size;
+			if (end > size ||
+			    fnv(buf + ock[a].off, end - ock[a].off) != ock[a].sum)
+				break;
+		}
+		if (a == nock && 0 == delta) {	/* all of it */
+			ckcopy(oh, h->nhit, 0, INT32_MAX, 0);
+			goto print;
+		}
+		if (a == nock)
+			a--;
+
+		/* and from the back */
+		for (b = nock; b > a + 1; b--) {
+			end = (b < nock) ? ock[b].off : h->size;
+			if ((int64_t)ock[b - 1].off + delta <
+			    (int64_t)ock[a].off ||
+			    fnv(buf + ock[b - 1].off + delta,
+			    end - ock[b - 1].off) != ock[b - 1].sum)
+				break;
+		}
+		want = b;
+
+		for (i = 0; i <= a; i++)
+			ckadd(ock[i].off, ock[i].line, ock[i].state);
+		p = ckcopy(oh, h->nhit, 0, ock[a].line, 0);
+		lexfrom.off = ock[a].off;
+		lexfrom.line = ock[a].line;
+		lexfrom.state = ock[a].state;
+	}
+	else
+		ckadd(lexfrom.off, lexfrom.line, lexfrom.state);
+
+	hithook = ckhit;
+	ckhook = ckline;
+	setinput(buf, size);
+	lex();
+	ckhook = NULL;
+	hithook = NULL;
+
+	if (-1 != cvg) {	/* the rest is as it was */
+		for (i = cvg; i < nock; i++)
+			ckadd(ock[i].off + delta,
+			    ock[i].line + cvgline - ock[cvg].line, ock[i].state);
+		ckcopy(oh, h->nhit, ock[cvg].line, INT32_MAX,
+		    cvgline - ock[cvg].line);
+	}
+	if (verbose && -1 != cvg)
+		fprintf(stderr, "%s: checkpoints: lexed lines %u to %d\n",
+		    getprogname(), ock[a].line, cvgline);
+	else if (verbose)
+		fprintf(stderr, "%s: checkpoints: lexed from line %u\n",
+		    getprogname(), (NULL != h) ? ock[a].line : 1);
+	ckwrite(key, buf, size);
+
+print:
+	for (p = hits.p, i = 0; i < nhit; i++) {
+		int line = getv(&p);
+
+		printhit((const char *)p, line);
+		p += strlen((const char *)p) + 1;
+	}
+	if (NULL != h)
+		munmap((void *)h, hlen);
+	if (NULL != buf)
+		munmap(buf, size);
+	free(key);
+}
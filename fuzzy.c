@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Approximate matching of identifiers.
+ *
+ * fzcomp() turns a literal into a Levenshtein automaton accepting every
+ * string within k insertions, deletions or substitutions of it, and
+ * fzmatch() runs that over a slice. The automaton is the bit-parallel
+ * NFA of Wu and Manber: row d holds one bit per pattern prefix, set when
+ * the prefix matches the text read so far with at most d errors, so each
+ * text byte costs k + 1 shifts and masks whatever the pattern. Since
+ * cgrep wants whole identifiers, the NFA is anchored at both ends, which
+ * also lets slices whose length is more than k off be turned away
+ * without looking at them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cgrep.h"
+
+#define FZMAX	64	/* longest pattern, one bit per byte of it */
+
+struct fuzzy {
+	int k;			/* errors allowed */
+	size_t m;		/* pattern length */
+	uint64_t accept;	/* bit of the whole pattern */
+	uint64_t all;		/* bits of every prefix */
+	uint64_t mask[256];	/* bits of the pattern bytes equal to each */
+	uint64_t *row;		/* k + 1 rows of state */
+};
+
+/*
+ * Compile the Levenshtein automaton for lit at distance k.
+ */
+struct fuzzy *
+fzcomp(const char *lit, int k)
+{
+	struct fuzzy *fz;
+	size_t i;
+
+	if (k < 0 || FZMAX <= k)	/* a row is a uint64_t */
+		fatal("%s: --fuzzy distance must be 0 to %d\n",
+		    getprogname(), FZMAX - 1);
+	fz = alloc(sizeof(*fz));
+	fz->k = k;
+	if (0 == (fz->m = strlen(lit)) || FZMAX < fz->m)
+		fatal("%s: --fuzzy pattern must be 1 to %d bytes\n",
+		    getprogname(), FZMAX);
+	for (i = 0; i < fz->m; i++)
+		fz->mask[(unsigned char)lit[i]] |= (uint64_t)1 << i;
+	fz->accept = (uint64_t)1 << (fz->m - 1);
+	fz->all = fz->accept | (fz->accept - 1);
+	fz->row = alloc(sizeof(uint64_t) * (k + 1));
+	return fz;
+}
+
+/*
+ * Is the slice p, n within k edits of the pattern?
+ */
+int
+fzmatch(const struct fuzzy *fz, const char *p, size_t n)
+{
+	uint64_t *r = fz->row;
+	uint64_t b, old, prev, live;
+	size_t t;
+	int d, k = fz->k;
+
+	if ((n > fz->m ? n - fz->m : fz->m - n) > (size_t)k)
+		return 0;
+
+	/* before any text d pattern bytes can be deleted */
+	for (d = 0; d <= k; d++)
+		r[d] = ((uint64_t)1 << d) - 1;
+
+	/*
+	 * The empty prefix is matched at row d while t <= d, t being the
+	 * bytes read so far, as they can all be insertions.
+	 */
+	for (t = 0; t < n; t++) {
+		b = fz->mask[(unsigned char)p[t]];
+		prev = r[0];	/* row d - 1 before this byte */
+		r[0] = ((r[0] << 1) | (0 == t)) & b;
+		live = r[0];
+		for (d = 1; d <= k; d++) {
+			old = r[d];
+			r[d] = (((old << 1) | (t <= (size_t)d)) & b) |	/* match */
+			    (prev << 1) | (t <= (size_t)d - 1) |	/* substitute */
+			    prev |					/* insert */
+			    (r[d - 1] << 1) | (t + 1 <= (size_t)d - 1);	/* delete */
+			r[d] &= fz->all;
+			prev = old;
+			live |= r[d];
+		}
+		if (0 == live && t >= (size_t)k)	/* all rows dead */
+			return 0;
+	}
+
+	for (d = 0; d <= k; d++)
+		if (r[d] & fz->accept)
+			return 1;
+	return 0;
+}
@@ -0,0 +1,938 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Git repositories.
+ *
+ * --git takes the files to search from the repository's index rather
+ * than from the command line, reading .git/index directly: it already
+ * lists every tracked path, sorted, with its blob id and the stat data
+ * seen when it was staged. As with git grep, run in a subdirectory it
+ * takes just the files under it, named relative to it.
+ *
+ * --changed-since=rev keeps only the files whose index entry differs
+ * from rev's tree, or that were changed after being staged. For that,
+ * and for --rev, objects are read from the object store: loose ones,
+ * and those in packs, following delta chains. Revisions may be an
+ * object id, a ref or HEAD, followed by ~n, ^ or ^n.
+ *
+ * --rev=rev searches rev's tree straight from the object store, each
+ * blob inflated into the lexer's input. The files are named rev:path.
+ * A blob is searched once however many paths and revisions share it,
+ * its hits kept to be printed again under the other names.
+ *
+ * Only SHA-1 repositories are read, and alternates are not followed.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "cgrep.h"
+
+#define PACK_OFS_DELTA	6	/* pack entry types beyond GIT_TAG */
+#define PACK_REF_DELTA	7
+
+#define IDX_MAGIC	0xff744f63	/* "\377tOc", pack index version 2 */
+
+struct pack {		/* a pack and its index, mapped */
+	const unsigned char *idx;
+	size_t idxLen;
+	const unsigned char *data;
+	size_t dataLen;
+	uint32_t n;		/* objects */
+};
+
+struct gitent {		/* an index entry, or a tree entry */
+	char *path;
+	unsigned char id[20];
+	int64_t sec;		/* stat data from the index */
+	int64_t nsec;
+	uint32_t size;
+};
+
+struct blobhits {	/* what searching a blob found */
+	unsigned char id[20];
+	char done;		/* searched */
+	uint32_t nhit;
+	struct post hits;	/* line varints, each with its text */
+};
+
+static char *gitdir;		/* .git, or where a .git file points */
+static char *common;		/* objects and refs, if not in gitdir */
+static char *prefix;		/* cwd within the work tree, "" or "dir/" */
+static struct pack *packs;
+static size_t npack, packsLen;
+
+static uint32_t
+be32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/*
+ * Convert 40 hex digits at hex to an object id. Returns -1 if they
+ * are not.
+ */
+static int
+unhex(const char *hex, unsigned char *id)
+{
+	int i, hi, lo;
+
+	for (i = 0; i < 20; i++) {
+		if (!isxdigit((unsigned char)hex[2 * i]) ||
+		    !isxdigit((unsigned char)hex[2 * i + 1]))
+			return -1;
+		hi = isdigit((unsigned char)hex[2 * i]) ? hex[2 * i] - '0' :
+		    (tolower((unsigned char)hex[2 * i]) - 'a' + 10);
+		lo = isdigit((unsigned char)hex[2 * i + 1]) ?
+		    hex[2 * i + 1] - '0' :
+		    (tolower((unsigned char)hex[2 * i + 1]) - 'a' + 10);
+		id[i] = hi << 4 | lo;
+	}
+	return 0;
+}
+
+/*
+ * The whole of file, NUL terminated, or NULL if it can't be read.
+ */
+static char *
+slurp(const char *file, size_t *lenp)
+{
+	struct stat st;
+	char *buf;
+	ssize_t n;
+	size_t len = 0;
+	int fd;
+
+	if (-1 == (fd = open(file, O_RDONLY)))
+		return NULL;
+	if (-1 == fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	buf = alloc(st.st_size + 1);
+	while (len < (size_t)st.st_size &&
+	    0 < (n = read(fd, buf + len, st.st_size - len)))
+		len += n;
+	close(fd);
+	if (NULL != lenp)
+		*lenp = len;
+	return buf;
+}
+
+/*
+ * A path under dir, in a buffer that lasts until the next call.
+ */
+static const char *
+under(const char *dir, const char *name)
+{
+	static char *path;
+	static size_t pathLen;
+
+	ROOM(path, pathLen, strlen(dir) + strlen(name) + 2);
+	sprintf(path, "%s/%s", dir, name);
+	return path;
+}
+
+/*
+ * Map in the packs under common/objects/pack.
+ */
+static void
+loadpacks(void)
+{
+	char dir[PATH_MAX], *name;
+	struct pack *pk;
+	struct dirent *e;
+	struct stat st;
+	size_t n;
+	DIR *d;
+	int fd;
+
+	snprintf(dir, sizeof(dir), "%s/objects/pack", common);
+	if (NULL == (d = opendir(dir)))
+		return;
+	while (NULL != (e = readdir(d))) {
+		n = strlen(e->d_name);
+		if (n < 5 || strcmp(e->d_name + n - 4, ".idx"))
+			continue;
+		TROOM(packs, packsLen, npack);
+		pk = &packs[npack];
+		if (NULL == (name = strdup(under(dir, e->d_name))))
+			fatal(outSpace);
+		if (-1 == (fd = open(name, O_RDONLY)) || -1 == fstat(fd, &st) ||
+		    (size_t)st.st_size < 8 + 256 * 4 ||
+		    MAP_FAILED == (pk->idx = mmap(NULL, st.st_size, PROT_READ,
+		    MAP_PRIVATE, fd, 0)))
+			fatal("%s: cannot read %s\n", getprogname(), name);
+		close(fd);
+		pk->idxLen = st.st_size;
+		if (IDX_MAGIC != be32(pk->idx) || 2 != be32(pk->idx + 4))
+			fatal("%s: %s is not a version 2 pack index\n",
+			    getprogname(), name);
+		pk->n = be32(pk->idx + 8 + 255 * 4);
+
+		strcpy(name + strlen(name) - 4, ".pack");
+		if (-1 == (fd = open(name, O_RDONLY)) || -1 == fstat(fd, &st) ||
+		    MAP_FAILED == (pk->data = mmap(NULL, st.st_size, PROT_READ,
+		    MAP_PRIVATE, fd, 0)))
+			fatal("%s: cannot read %s\n", getprogname(), name);
+		close(fd);
+		pk->dataLen = st.st_size;
+		free(name);
+		npack++;
+	}
+	closedir(d);
+}
+
+/*
+ * Find the repository holding the current directory.
+ */
+static void
+gitfind(void)
+{
+	char cwd[PATH_MAX], *p, *s;
+	struct stat st;
+	size_t n;
+
+	if (NULL != gitdir)
+		return;
+	if (NULL == getcwd(cwd, sizeof(cwd)))
+		fatal("%s: cannot find the current directory\n",
+		    getprogname());
+	for (n = strlen(cwd); ; ) {
+		cwd[n] = '\0';
+		if (-1 != stat(under(cwd, ".git"), &st))
+			break;
+		if (NULL == (p = strrchr(cwd, '/')) || p == cwd)
+			fatal("%s: not in a git work tree\n", getprogname());
+		n = p - cwd;
+	}
+
+	/* the path from the top down to where we are */
+	p = getcwd(NULL, 0);
+	if (NULL == p)
+		fatal(outSpace);
+	if (strlen(p) > n) {
+		if (-1 == asprintf(&prefix, "%s/", p + n + 1))
+			fatal(outSpace);
+	}
+	else if (NULL == (prefix = strdup("")))
+		fatal(outSpace);
+	free(p);
+
+	if (S_ISDIR(st.st_mode)) {
+		if (NULL == (gitdir = strdup(under(cwd, ".git"))))
+			fatal(outSpace);
+	}
+	else {			/* "gitdir: path" of a worktree or submodule */
+		if (NULL == (s = slurp(under(cwd, ".git"), NULL)) ||
+		    strncmp(s, "gitdir: ", 8))
+			fatal("%s: cannot read %s/.git\n", getprogname(), cwd);
+		s[strcspn(s, "\n")] = '\0';
+		if ('/' == s[8])
+			gitdir = strdup(s + 8);
+		else
+			gitdir = strdup(under(cwd, s + 8));
+		if (NULL == gitdir)
+			fatal(outSpace);
+		free(s);
+	}
+
+	/* a linked worktree keeps its objects and refs elsewhere */
+	if (NULL != (s = slurp(under(gitdir, "commondir"), NULL))) {
+		s[strcspn(s, "\n")] = '\0';
+		common = strdup('/' == s[0] ? s : under(gitdir, s));
+		free(s);
+	}
+	else
+		common = strdup(gitdir);
+	if (NULL == common)
+		fatal(outSpace);
+	loadpacks();
+}
+
+/*
+ * Inflate the zlib stream at p, of at most avail bytes, into a buffer of
+ * want bytes, or as many as it holds if want is 0. Returns the buffer,
+ * NUL terminated, with its length in *lenp.
+ */
+static unsigned char *
+inflated(const unsigned char *p, size_t avail, size_t want, size_t *lenp)
+{
+	unsigned char *out = NULL;
+	size_t has = 0;
+	z_stream z;
+	int r;
+
+	memset(&z, 0, sizeof(z));
+	if (Z_OK != inflateInit(&z))
+		fatal(outSpace);
+	z.next_in = (unsigned char *)p;
+	z.avail_in = avail;
+	do {			/* all at once if the size is known */
+		if (z.total_out + 1 >= has) {
+			has = want ? want + 1 : (has ? 2 * has : 8192);
+			if (NULL == (out = realloc(out, has)))
+				fatal(outSpace);
+		}
+		z.next_out = out + z.total_out;
+		z.avail_out = has - 1 - z.total_out;
+		r = inflate(&z, Z_NO_FLUSH);
+	} while (Z_OK == r && (0 == want || z.total_out < want));
+	if ((Z_STREAM_END != r && Z_OK != r) || (want && z.total_out != want))
+		fatal("%s: damaged object in %s\n", getprogname(), common);
+	out[z.total_out] = '\0';
+	*lenp = z.total_out;
+	inflateEnd(&z);
+	return out;
+}
+
+/*
+ * Apply delta to base, both of their lengths, returning the result and
+ * setting *lenp to its length.
+ */
+static unsigned char *
+patch(const unsigned char *base, size_t blen, const unsigned char *d,
+    size_t dlen, size_t *lenp)
+{
+	const unsigned char *end = d + dlen;
+	unsigned char *out, *o;
+	size_t src = 0, dst = 0, off, n;
+	int shift, i;
+
+	for (shift = 0; d < end; shift += 7) {
+		src |= (size_t)(*d & 0x7f) << shift;
+		if (!(*d++ & 0x80))
+			break;
+	}
+	for (shift = 0; d < end; shift += 7) {
+		dst |= (size_t)(*d & 0x7f) << shift;
+		if (!(*d++ & 0x80))
+			break;
+	}
+	if (src != blen)
+		fatal("%s: bad delta in %s\n", getprogname(), common);
+
+	o = out = alloc(dst + 1);
+	while (d < end) {
+		if (*d & 0x80) {	/* copy from base */
+			int op = *d++;
+
+			for (n = 0, i = 0; i < 7; i++)	/* bytes that follow */
+				n += (op >> i) & 1;
+			if (n > (size_t)(end - d))
+				fatal("%s: bad delta in %s\n", getprogname(),
+				    common);
+			for (off = 0, i = 0; i < 4; i++)
+				if (op & (1 << i))
+					off |= (size_t)*d++ << (8 * i);
+			for (n = 0, i = 0; i < 3; i++)
+				if (op & (0x10 << i))
+					n |= (size_t)*d++ << (8 * i);
+			if (0 == n)
+				n = 0x10000;
+		}
+		else {			/* insert */
+			n = *d++;
+			if (0 == n || n > (size_t)(end - d) ||
+			    n > dst - (o - out))
+				fatal("%s: bad delta in %s\n", getprogname(),
+				    common);
+			memcpy(o, d, n);
+			o += n;
+			d += n;
+			continue;
+		}
+		if (off + n > blen || n > dst - (o - out))
+			fatal("%s: bad delta in %s\n", getprogname(), common);
+		memcpy(o, base + off, n);
+		o += n;
+	}
+	if ((size_t)(o - out) != dst)
+		fatal("%s: bad delta in %s\n", getprogname(), common);
+	*lenp = dst;
+	return out;
+}
+
+/*
+ * Find object id in a pack, setting *pkp and *offp. Returns -1 if no
+ * pack has it.
+ */
+static int
+packfind(const unsigned char *id, struct pack **pkp, uint64_t *offp)
+{
+	const unsigned char *ids, *ofs;
+	struct pack *pk;
+	uint32_t lo, hi, mid, o;
+	size_t i;
+	int r;
+
+	for (i = 0; i < npack; i++) {
+		pk = &packs[i];
+		lo = (0 == id[0]) ? 0 : be32(pk->idx + 8 + (id[0] - 1) * 4);
+		hi = be32(pk->idx + 8 + id[0] * 4);
+		ids = pk->idx + 8 + 256 * 4;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (0 == (r = memcmp(id, ids + 20 * (size_t)mid, 20))) {
+				ofs = ids + 24 * (size_t)pk->n;
+				o = be32(ofs + 4 * (size_t)mid);
+				if (o & 0x80000000) {	/* in the 64 bit table */
+					ofs += 4 * (size_t)pk->n +
+					    8 * (size_t)(o & 0x7fffffff);
+					*offp = (uint64_t)be32(ofs) << 32 |
+					    be32(ofs + 4);
+				}
+				else
+					*offp = o;
+				*pkp = pk;
+				return 0;
+			}
+			if (r < 0)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+	}
+	return -1;
+}
+
+/*
+ * The object at off in pk, its type in *type and length in *lenp.
+ */
+static unsigned char *
+packobj(struct pack *pk, uint64_t off, int *type, size_t *lenp)
+{
+	const unsigned char *p = pk->data + off, *end = pk->data + pk->dataLen;
+	unsigned char *base, *delta, *out;
+	size_t size, blen, dlen;
+	uint64_t boff;
+	int shift;
+
+	if (off >= pk->dataLen)
+		fatal("%s: damaged pack in %s\n", getprogname(), common);
+	*type = (*p >> 4) & 7;
+	size = *p & 0x0f;
+	for (shift = 4; (*p++ & 0x80) && p < end; shift += 7)
+		size |= (size_t)(*p & 0x7f) << shift;
+
+	switch (*type) {
+	case GIT_COMMIT:
+	case GIT_TREE:
+	case GIT_BLOB:
+	case GIT_TAG:
+		return inflated(p, end - p, size, lenp);
+	case PACK_OFS_DELTA:
+		boff = *p & 0x7f;
+		while ((*p++ & 0x80) && p < end)
+			boff = ((boff + 1) << 7) | (*p & 0x7f);
+		if (0 == boff || boff > off)
+			fatal("%s: damaged pack in %s\n", getprogname(),
+			    common);
+		base = packobj(pk, off - boff, type, &blen);
+		break;
+	case PACK_REF_DELTA:
+		if (NULL == (base = gitobj(p, type, &blen)))
+			fatal("%s: missing delta base in %s\n", getprogname(),
+			    common);
+		p += 20;
+		break;
+	default:
+		fatal("%s: damaged pack in %s\n", getprogname(), common);
+	}
+	delta = inflated(p, end - p, size, &dlen);
+	out = patch(base, blen, delta, dlen, lenp);
+	free(base);
+	free(delta);
+	return out;
+}
+
+/*
+ * Object id, inflated and NUL terminated, with its type (GIT_COMMIT,
+ * GIT_TREE, GIT_BLOB or GIT_TAG) in *type and length in *lenp. NULL
+ * if there is no such object.
+ */
+unsigned char *
+gitobj(const unsigned char *id, int *type, size_t *lenp)
+{
+	static const char *const names[] = { "", "commit", "tree", "blob",
+	    "tag" };
+	char hex[41], *loose;
+	unsigned char *buf, *obj, *nul;
+	struct pack *pk;
+	uint64_t off;
+	size_t len, n;
+	int i;
+
+	gitfind();
+	if (0 == packfind(id, &pk, &off))
+		return packobj(pk, off, type, lenp);
+
+	for (i = 0; i < 20; i++)
+		sprintf(hex + 2 * i, "%02x", id[i]);
+	if (-1 == asprintf(&loose, "%s/objects/%.2s/%s", common, hex, hex + 2))
+		fatal(outSpace);
+	if (NULL == (buf = (unsigned char *)slurp(loose, &len))) {
+		free(loose);
+		return NULL;
+	}
+	free(loose);
+	obj = inflated(buf, len, 0, &n);
+	free(buf);
+
+	/* "type size\0" then the object */
+	if (NULL == (nul = memchr(obj, '\0', n)))
+		fatal("%s: damaged object in %s\n", getprogname(), common);
+	for (*type = GIT_TAG; *type > 0; (*type)--)
+		if (!strncmp((char *)obj, names[*type],
+		    strlen(names[*type])) &&
+		    ' ' == obj[strlen(names[*type])])
+			break;
+	if (0 == *type)
+		fatal("%s: damaged object in %s\n", getprogname(), common);
+	*lenp = n - (nul + 1 - obj);
+	memmove(obj, nul + 1, *lenp + 1);
+	return obj;
+}
+
+/*
+ * Resolve ref name, following symbolic refs, looking first at its own
+ * file and then in packed-refs. Returns -1 if there is no such ref.
+ */
+static int
+readref(const char *name, unsigned char *id, int depth)
+{
+	char *s, *p, *nl;
+	size_t n;
+	int r = -1;
+
+	if (depth > 5)
+		return -1;
+	if (NULL != (s = slurp(under(gitdir, name), NULL)) ||
+	    NULL != (s = slurp(under(common, name), NULL))) {
+		s[strcspn(s, "\n")] = '\0';
+		if (!strncmp(s, "ref: ", 5))
+			r = readref(s + 5, id, depth + 1);
+		else if (strlen(s) >= 40)
+			r = unhex(s, id);
+		free(s);
+		return r;
+	}
+
+	/* "id name" lines, and "^id" lines peeling the tag above */
+	if (NULL == (s = slurp(under(common, "packed-refs"), NULL)))
+		return -1;
+	n = strlen(name);
+	for (p = s; '\0' != *p; p = nl + ('\n' == *nl)) {
+		nl = p + strcspn(p, "\n");
+		if ('#' != *p && '^' != *p && (size_t)(nl - p) == 41 + n &&
+		    ' ' == p[40] && !strncmp(p + 41, name, n)) {
+			r = unhex(p, id);
+			break;
+		}
+	}
+	free(s);
+	return r;
+}
+
+/*
+ * Commit id, through any tags pointing at it.
+ */
+static void
+peel(unsigned char *id, const char *rev)
+{
+	unsigned char *obj;
+	size_t len;
+	int type;
+
+	for (;;) {
+		if (NULL == (obj = gitobj(id, &type, &len)))
+			fatal("%s: %s: object not found\n", getprogname(), rev);
+		if (GIT_COMMIT == type)
+			break;
+		if (GIT_TAG != type || strncmp((char *)obj, "object ", 7) ||
+		    len < 47 || -1 == unhex((char *)obj + 7, id))
+			fatal("%s: %s is not a commit\n", getprogname(), rev);
+		free(obj);
+	}
+	free(obj);
+}
+
+/*
+ * Replace commit id with its n'th parent, or its tree if n is 0.
+ */
+static void
+follow(unsigned char *id, int n, const char *rev)
+{
+	const char *want = n ? "parent " : "tree ";
+	unsigned char *obj;
+	char *p;
+	size_t len;
+	int type;
+
+	if (NULL == (obj = gitobj(id, &type, &len)) || GIT_COMMIT != type)
+		fatal("%s: %s: no such revision\n", getprogname(), rev);
+	for (p = (char *)obj; '\0' != *p && '\n' != *p;
+	    p += strcspn(p, "\n") + ('\0' != p[strcspn(p, "\n")]))
+		if (!strncmp(p, want, strlen(want)) && n-- <= 1)
+			break;
+	if (strncmp(p, want, strlen(want)) ||
+	    -1 == unhex(p + strlen(want), id))
+		fatal("%s: %s: no such revision\n", getprogname(), rev);
+	free(obj);
+}
+
+/*
+ * Resolve rev to a commit id: an object id or ref, then any of ~n,
+ * ^n and ^ (n defaulting to 1).
+ */
+void
+gitrev(const char *rev, unsigned char *id)
+{
+	static const char *const forms[] = { "%.*s", "refs/%.*s",
+	    "refs/tags/%.*s", "refs/heads/%.*s", "refs/remotes/%.*s",
+	    "refs/remotes/%.*s/HEAD" };
+	char name[PATH_MAX];
+	const char *base = rev, *p;
+	size_t i, n;
+	long k;
+	char op;
+
+	gitfind();
+	n = strcspn(rev, "~^");
+	if (0 == n || (1 == n && '@' == *rev))
+		base = "HEAD", n = 4;	/* the suffix is still rev's */
+	if (40 != n || -1 == unhex(base, id)) {
+		for (i = 0; i < sizeof(forms) / sizeof(forms[0]); i++) {
+			snprintf(name, sizeof(name), forms[i], (int)n, base);
+			if (0 == readref(name, id, 0))
+				break;
+		}
+		if (i == sizeof(forms) / sizeof(forms[0]))
+			fatal("%s: %.*s: no such revision\n", getprogname(),
+			    (int)n, base);
+	}
+	peel(id, rev);
+
+	for (p = rev + strcspn(rev, "~^"); '\0' != *p; ) {
+		op = *p++;
+		k = 1;
+		if (isdigit((unsigned char)*p))
+			k = strtol(p, (char **)&p, 10);
+		if ('~' != op && '^' != op)
+			fatal("%s: %s: no such revision\n", getprogname(), rev);
+		if ('^' == op && k)
+			follow(id, k, rev);
+		else
+			while ('~' == op && k--)
+				follow(id, 1, rev);
+	}
+}
+
+static struct gitent *tents;	/* a tree's files, in path order */
+static size_t ntent, tentsLen;
+
+/*
+ * Add the files in tree to tents, named as under dir, taking only
+ * those under prefix.
+ */
+static void
+treewalk(const unsigned char *tree, const char *dir)
+{
+	unsigned char *obj, *p, *end, *nul;
+	char *path;
+	size_t len, plen = strlen(prefix);
+	int type;
+
+	if (NULL == (obj = gitobj(tree, &type, &len)) || GIT_TREE != type)
+		fatal("%s: missing tree in %s\n", getprogname(), common);
+	for (p = obj, end = obj + len; p < end; p = nul + 21) {
+		/* "mode name\0" and a binary id */
+		if (NULL == (nul = memchr(p, '\0', end - p)) || nul + 21 > end)
+			fatal("%s: damaged tree in %s\n", getprogname(),
+			    common);
+		if (-1 == asprintf(&path, "%s%s%s", dir,
+		    strchr((char *)p, ' ') + 1,
+		    strncmp((char *)p, "40000 ", 6) ? "" : "/"))
+			fatal(outSpace);
+		if (!strncmp((char *)p, "40000 ", 6)) {
+			len = strlen(path);
+			if (!strncmp(path, prefix, len < plen ? len : plen))
+				treewalk(nul + 1, path);
+			free(path);
+		}
+		else if ('1' == *p && '0' == p[1] &&
+		    !strncmp(path, prefix, plen)) {
+			TROOM(tents, tentsLen, ntent);
+			tents[ntent].path = path;
+			memcpy(tents[ntent++].id, nul + 1, 20);
+		}
+		else			/* symlinks and submodules */
+			free(path);
+	}
+	free(obj);
+}
+
+static int
+entcmp(const void *a, const void *b)
+{
+	return strcmp(((const struct gitent *)a)->path,
+	    ((const struct gitent *)b)->path);
+}
+
+/*
+ * The files in the index under the current directory, named relative
+ * to it, and just those that differ from rev if since is set. Returns
+ * their names, NULL terminated, with their number in *np.
+ */
+char **
+gitfiles(const char *since, int *np)
+{
+	unsigned char *buf, *e, *q, *end, id[20];
+	struct gitent key, *t;
+	char **names = NULL, *name = NULL, *last = "";
+	size_t len, nameLen = 0, namesLen = 0, n = 0, plen, k, strip;
+	uint32_t ver, count, i, flags, ext, mode;
+	struct stat st;
+
+	gitfind();
+	plen = strlen(prefix);
+	if (NULL != since) {
+		gitrev(since, id);
+		follow(id, 0, since);
+		treewalk(id, "");
+		qsort(tents, ntent, sizeof(tents[0]), entcmp);
+	}
+
+	if (NULL == (buf = (unsigned char *)slurp(under(gitdir, "index"),
+	    &len)))
+		fatal("%s: cannot read %s/index\n", getprogname(), gitdir);
+	if (len < 12 + 20 || memcmp(buf, "DIRC", 4) ||
+	    (ver = be32(buf + 4)) < 2 || ver > 4)
+		fatal("%s: %s/index is not a version 2-4 index\n",
+		    getprogname(), gitdir);
+	count = be32(buf + 8);
+	end = buf + len - 20;
+	ROOM(name, nameLen, 1);
+	name[0] = '\0';
+
+	for (e = buf + 12, i = 0; i < count; i++) {
+		if (e + 62 > end)
+			fatal("%s: damaged index in %s\n", getprogname(),
+			    gitdir);
+		mode = be32(e + 24);
+		flags = e[60] << 8 | e[61];
+		q = e + 62;
+		ext = 0;
+		if (flags & 0x4000) {
+			ext = q[0] << 8 | q[1];
+			q += 2;
+		}
+		if (4 == ver) {		/* strip some of the last name */
+			strip = *q & 0x7f;
+			while (*q++ & 0x80)
+				strip = ((strip + 1) << 7) | (*q & 0x7f);
+			k = strlen(name);
+			k -= strip < k ? strip : k;
+			ROOM(name, nameLen, k + strlen((char *)q) + 1);
+			strcpy(name + k, (char *)q);
+			k += strlen((char *)q);
+			q += strlen((char *)q) + 1;
+		}
+		else {
+			if (0xfff == (k = flags & 0xfff))
+				k = strlen((char *)q);
+			ROOM(name, nameLen, k + 1);
+			memcpy(name, q, k);
+			name[k] = '\0';
+			q = e + ((q - e + k + 8) & ~7);
+		}
+		if (q > end)
+			fatal("%s: damaged index in %s\n", getprogname(),
+			    gitdir);
+
+		/*
+		 * Regular files under the cwd and checked out; a conflicted
+		 * file has several stages and is taken once.
+		 */
+		if (0100000 != (mode & 0170000) || (ext & 0x4000) ||
+		    strncmp(name, prefix, plen) || !strcmp(name + plen, last) ||
+		    !csource(name))
+			goto next;
+
+		if (NULL != since && 0 == (flags & 0x3000) &&
+		    !(ext & 0x2000)) {
+			key.path = name;
+			t = bsearch(&key, tents, ntent, sizeof(tents[0]),
+			    entcmp);
+			if (NULL != t && !memcmp(t->id, e + 40, 20) &&
+			    -1 != stat(name + plen, &st) &&
+			    st.st_size == (off_t)be32(e + 36) &&
+			    st.st_mtim.tv_sec == (time_t)be32(e + 8) &&
+			    (0 == be32(e + 12) ||
+			    st.st_mtim.tv_nsec == (long)be32(e + 12)))
+				goto next;
+		}
+		TROOM(names, namesLen, n + 1);
+		if (NULL == (names[n++] = last = strdup(name + plen)))
+			fatal(outSpace);
+next:
+		e = q;
+	}
+	free(buf);
+	free(name);
+	for (k = 0; k < ntent; k++)
+		free(tents[k].path);
+	ntent = 0;
+
+	if (NULL == names)
+		names = alloc(sizeof(*names));
+	names[n] = NULL;
+	*np = n;
+	return names;
+}
+
+static struct blobhits *blobs;	/* hash table of the blobs searched */
+static size_t blobsLen, nblob;
+static size_t searched, reused;	/* for --verbose */
+static struct blobhits *cur;	/* being searched */
+
+/*
+ * The entry in blobs for blob id, empty if it was not searched yet.
+ */
+static struct blobhits *
+blobfind(const unsigned char *id)
+{
+	struct blobhits *old = blobs;
+	size_t i, n = blobsLen;
+
+	if (2 * (nblob + 1) > blobsLen) {	/* grow, and rehash */
+		blobsLen = blobsLen ? 2 * blobsLen : 1024;
+		blobs = alloc(blobsLen * sizeof(*blobs));
+		memset(blobs, 0, blobsLen * sizeof(*blobs));
+		for (i = 0; i < n; i++)
+			if (old[i].done)
+				*blobfind(old[i].id) = old[i];
+		free(old);
+	}
+	for (i = be32(id) & (blobsLen - 1); blobs[i].done;
+	    i = (i + 1) & (blobsLen - 1))
+		if (!memcmp(blobs[i].id, id, 20))
+			return &blobs[i];
+	memcpy(blobs[i].id, id, 20);
+	return &blobs[i];
+}
+
+/*
+ * The hithook: keep a hit of the blob being searched.
+ */
+static void
+blobhit(const char *s, int line)
+{
+	size_t n = strlen(s) + 1;
+
+	putv(&cur->hits, line);
+	ROOM(cur->hits.p, cur->hits.has, cur->hits.len + n);
+	memcpy(cur->hits.p + cur->hits.len, s, n);
+	cur->hits.len += n;
+	cur->nhit++;
+}
+
+/*
+ * Search the sources in rev's tree under the current directory.
+ */
+void
+gitsearch(const char *rev)
+{
+	const unsigned char *p;
+	unsigned char id[20], *obj;
+	struct blobhits *b;
+	size_t i, len, plen;
+	uint32_t k, line;
+	int type;
+
+	gitfind();
+	plen = strlen(prefix);
+	gitrev(rev, id);
+	follow(id, 0, rev);
+	treewalk(id, "");
+	qsort(tents, ntent, sizeof(tents[0]), entcmp);
+
+	for (i = 0; i < ntent; i++) {
+		if (!csource(tents[i].path) || tarname(tents[i].path))
+			continue;	/* an archive is not read from a blob */
+		if (-1 == asprintf(&filen, "%s:%s", rev,
+		    tents[i].path + plen))
+			fatal(outSpace);
+		b = blobfind(tents[i].id);
+		if (b->done)
+			reused++;
+		else {
+			if (NULL == (obj = gitobj(tents[i].id, &type, &len)) ||
+			    GIT_BLOB != type)
+				fatal("%s: %s: missing blob\n", getprogname(),
+				    filen);
+			b->done = 1;
+			nblob++;
+			cur = b;
+			hithook = blobhit;
+			setinput((char *)obj, len);
+			lex();
+			hithook = NULL;
+			free(obj);
+			searched++;
+		}
+		for (p = b->hits.p, k = 0; k < b->nhit; k++) {
+			line = getv(&p);
+			printhit((const char *)p, line);
+			p += strlen((const char *)p) + 1;
+		}
+		free(filen);
+		filen = NULL;
+	}
+
+	for (i = 0; i < ntent; i++)
+		free(tents[i].path);
+	ntent = 0;
+	if (verbose)
+		fprintf(stderr, "%s: %s: %zu blobs searched, %zu reused\n",
+		    getprogname(), rev, searched, reused);
+}
@@ -0,0 +1,821 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * The identifier index.
+ *
+ * cgrep only ever matches whole identifiers and chains, so a query can
+ * be answered from the distinct slices of a tree rather than from every
+ * occurrence. "cgrep --index build DIR" lexes every C source under DIR
+ * and writes DIR/.cgrepidx, laid out for mmap:
+ *
+ *	struct ixhdr
+ *	struct ixfile [nfile]	sorted by path
+ *	struct ixword [nword]	sorted by text
+ *	struct ixtri [ntri]	sorted by key
+ *	paths and word texts
+ *	postings, one list per word
+ *	postings, one list per trigram
+ *
+ * A word posting list is a run of varints: a file number increment and a
+ * line number, or, when the increment is 0, a line number increment. A
+ * query runs the pattern over the dictionary, gathers the postings of
+ * the words that match, and prints those lines from each file whose
+ * mtime and size still agree with the index. Files that have changed, or
+ * are new since the build, are lexed as usual.
+ *
+ * The trigrams are those of every string and comment body, keyed by the
+ * three bytes and whether they came from a comment; their postings are
+ * just file number increments. -s or -c with -e lexes only the files
+ * holding every trigram the pattern is sure to need, plus stale ones.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cgrep.h"
+
+#define IX_MAGIC	0x0a494743	/* "CGI\n" read as a native integer */
+#define IX_VERSION	3	/* 3: decoded strings, joined comments */
+#define IX_NAME		".cgrepidx"
+
+struct ixhdr {		/* start of an index */
+	uint32_t magic;		/* IX_MAGIC, also catches byte order */
+	uint32_t version;	/* IX_VERSION */
+	uint32_t nfile;		/* files indexed */
+	uint32_t nword;		/* distinct slices */
+	uint32_t ntri;		/* distinct trigrams */
+	uint32_t pad;
+	uint64_t size;		/* bytes in the whole index */
+};
+
+struct ixfile {		/* an indexed file */
+	uint64_t path;		/* offset of its path, relative to DIR */
+	int64_t size;		/* st_size when indexed */
+	int64_t sec;		/* st_mtim when indexed */
+	int64_t nsec;
+};
+
+struct ixword {		/* a dictionary entry */
+	uint64_t text;		/* offset of the slice */
+	uint64_t post;		/* offset of its postings */
+	uint32_t len;		/* bytes of slice */
+	uint32_t plen;		/* bytes of postings */
+};
+
+struct ixtri {		/* a trigram */
+	uint32_t key;		/* comment << 24 | the bytes */
+	uint32_t plen;		/* bytes of postings */
+	uint64_t post;		/* offset of its postings */
+};
+
+struct word {		/* a dictionary entry while building */
+	char *text;
+	uint32_t len;
+	uint32_t hash;
+	uint32_t file, line;	/* last posting, for deltas */
+	struct post post;
+};
+
+struct tri {		/* a trigram while building */
+	uint32_t key;
+	uint32_t file;		/* last posting */
+	struct post post;
+};
+
+struct hit {		/* a posting matched by a query */
+	uint32_t file;
+	uint32_t line;
+};
+
+static struct word **wtab;	/* words by hash */
+static uint32_t wmask;		/* size of wtab - 1 */
+static uint32_t nwords;
+static uint32_t curfile;	/* file being built */
+
+static struct tri **ttab;	/* trigrams by key */
+static uint32_t tmask;		/* size of ttab - 1 */
+static uint32_t ntris;
+static uint32_t *ftri;		/* trigrams of the current file */
+static size_t nftri, ftriLen;
+
+/*
+ * Append varint v to a posting list.
+ */
+void
+putv(struct post *pl, uint32_t v)
+{
+	ROOM(pl->p, pl->has, pl->len + 5);
+	while (v >= 0x80) {
+		pl->p[pl->len++] = v | 0x80;
+		v >>= 7;
+	}
+	pl->p[pl->len++] = v;
+}
+
+/*
+ * Read a varint at *pp.
+ */
+uint32_t
+getv(const unsigned char **pp)
+{
+	const unsigned char *p = *pp;
+	uint32_t v = 0;
+	int shift = 0;
+
+	do
+		v |= (uint32_t)(*p & 0x7f) << shift, shift += 7;
+	while (*p++ & 0x80);
+	*pp = p;
+	return v;
+}
+
+/*
+ * Step *pp over a varint that ends before end; 0 if it runs past end
+ * or is too long for 32 bits.
+ */
+int
+skipv(const unsigned char **pp, const unsigned char *end)
+{
+	const unsigned char *p = *pp;
+	int n = 0;
+
+	do
+		if (p >= end || ++n > 5)
+			return 0;
+	while (*p++ & 0x80);
+	*pp = p;
+	return 1;
+}
+
+/*
+ * The slicehook while building: post slice p, n at line.
+ */
+static void
+ixslice(const char *p, size_t n, int line)
+{
+	struct word *w, **nt;
+	uint32_t h, slot, i;
+
+	h = fnv(p, n);
+	for (slot = h & wmask; NULL != (w = wtab[slot]);
+	    slot = (slot + 1) & wmask)
+		if (w->hash == h && w->len == n && !memcmp(w->text, p, n))
+			break;
+
+	if (NULL == w) {
+		w = wtab[slot] = alloc(sizeof(*w));
+		w->text = alloc(n + 1);
+		memcpy(w->text, p, n);
+		w->len = n;
+		w->hash = h;
+		w->file = curfile;
+		putv(&w->post, curfile);
+		putv(&w->post, line);
+		w->line = line;
+		if (++nwords > wmask / 2) {	/* grow the table */
+			nt = alloc(sizeof(*nt) * 2 * (wmask + 1));
+			for (i = 0; i <= wmask; i++) {
+				if (NULL == (w = wtab[i]))
+					continue;
+				for (slot = w->hash & (2 * wmask + 1);
+				    NULL != nt[slot];
+				    slot = (slot + 1) & (2 * wmask + 1))
+					;
+				nt[slot] = w;
+			}
+			free(wtab);
+			wtab = nt;
+			wmask = 2 * wmask + 1;
+		}
+		return;
+	}
+
+	if (w->file != curfile) {
+		putv(&w->post, curfile - w->file);
+		putv(&w->post, line);
+	}
+	else if (w->line != (uint32_t)line) {
+		putv(&w->post, 0);
+		putv(&w->post, line - w->line);
+	}
+	w->file = curfile;
+	w->line = line;
+}
+
+/*
+ * The texthook while building: note the trigrams of a string or comment.
+ */
+static void
+ixtext(const char *p, size_t n, int kind)
+{
+	uint32_t key = ('c' == kind) << 24;
+	size_t i;
+
+	for (i = 0; i + 2 < n; i++) {
+		TROOM(ftri, ftriLen, nftri);
+		ftri[nftri++] = key | (unsigned char)p[i] << 16 |
+		    (unsigned char)p[i + 1] << 8 | (unsigned char)p[i + 2];
+	}
+}
+
+static int
+keycmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Post the current file to each distinct trigram noted by ixtext().
+ */
+static void
+ixtriflush(void)
+{
+	struct tri *t, **nt;
+	uint32_t slot, i;
+	size_t k;
+
+	qsort(ftri, nftri, sizeof(*ftri), keycmp);
+	for (k = 0; k < nftri; k++) {
+		if (k && ftri[k] == ftri[k - 1])
+			continue;
+		for (slot = fnv(&ftri[k], sizeof(*ftri)) & tmask;
+		    NULL != (t = ttab[slot]) && t->key != ftri[k];
+		    slot = (slot + 1) & tmask)
+			;
+		if (NULL != t) {
+			putv(&t->post, curfile - t->file);
+			t->file = curfile;
+			continue;
+		}
+
+		t = ttab[slot] = alloc(sizeof(*t));
+		t->key = ftri[k];
+		t->file = curfile;
+		putv(&t->post, curfile);
+		if (++ntris > tmask / 2) {	/* grow the table */
+			nt = alloc(sizeof(*nt) * 2 * (tmask + 1));
+			for (i = 0; i <= tmask; i++) {
+				if (NULL == ttab[i])
+					continue;
+				for (slot = fnv(&ttab[i]->key, sizeof(uint32_t)) &
+				    (2 * tmask + 1); NULL != nt[slot];
+				    slot = (slot + 1) & (2 * tmask + 1))
+					;
+				nt[slot] = ttab[i];
+			}
+			free(ttab);
+			ttab = nt;
+			tmask = 2 * tmask + 1;
+		}
+	}
+	nftri = 0;
+}
+
+static int
+tricmp(const void *a, const void *b)
+{
+	return keycmp(&(*(struct tri *const *)a)->key,
+	    &(*(struct tri *const *)b)->key);
+}
+
+static int
+wordcmp(const void *a, const void *b)
+{
+	const struct word *x = *(struct word *const *)a;
+	const struct word *y = *(struct word *const *)b;
+	int r;
+
+	if (0 != (r = memcmp(x->text, y->text,
+	    x->len < y->len ? x->len : y->len)))
+		return r;
+	return (x->len > y->len) - (x->len < y->len);
+}
+
+/*
+ * Index the sources under dir into dir/.cgrepidx.
+ */
+void
+ixbuild(const char *dir)
+{
+	struct ixhdr h;
+	struct ixfile xf;
+	struct ixword xw;
+	struct ixtri xt;
+	struct word **ws, *w;
+	struct tri **ts, *t;
+	uint64_t toff, poff;
+	uint32_t i, n, nt;
+	char *idx, *tmp;
+	FILE *fp;
+
+	walk(dir);
+	wmask = tmask = 1023;
+	wtab = alloc(sizeof(*wtab) * (wmask + 1));
+	ttab = alloc(sizeof(*ttab) * (tmask + 1));
+	nwords = ntris = 0;
+	slicehook = ixslice;
+	texthook = ixtext;
+	for (curfile = 0; curfile < nfiles; curfile++) {
+		filen = files[curfile].path;
+		lex();
+		ixtriflush();
+	}
+	slicehook = NULL;
+	texthook = NULL;
+
+	/* sort the dictionary and trigrams */
+	ws = alloc(sizeof(*ws) * (nwords + 1));
+	for (i = n = 0; i <= wmask; i++)
+		if (NULL != wtab[i])
+			ws[n++] = wtab[i];
+	qsort(ws, n, sizeof(*ws), wordcmp);
+	ts = alloc(sizeof(*ts) * (ntris + 1));
+	for (i = nt = 0; i <= tmask; i++)
+		if (NULL != ttab[i])
+			ts[nt++] = ttab[i];
+	qsort(ts, nt, sizeof(*ts), tricmp);
+
+	if ((-1 == asprintf(&idx, "%s/%s", dir, IX_NAME)) ||
+	    (-1 == asprintf(&tmp, "%s.tmp", idx)))
+		fatal(outSpace);
+	if (NULL == (fp = fopen(tmp, "w")))
+		fatal("%s: cannot create %s\n", getprogname(), tmp);
+
+	memset(&h, 0, sizeof(h));
+	h.magic = IX_MAGIC;
+	h.version = IX_VERSION;
+	h.nfile = nfiles;
+	h.nword = n;
+	h.ntri = nt;
+	toff = sizeof(h) + sizeof(xf) * nfiles + sizeof(xw) * n +
+	    sizeof(xt) * nt;
+	poff = toff;
+	for (i = 0; i < nfiles; i++)
+		poff += strlen(files[i].rel) + 1;
+	for (i = 0; i < n; i++)
+		poff += ws[i]->len;
+	h.size = poff;
+	for (i = 0; i < n; i++)
+		h.size += ws[i]->post.len;
+	for (i = 0; i < nt; i++)
+		h.size += ts[i]->post.len;
+	fwrite(&h, sizeof(h), 1, fp);
+
+	for (i = 0; i < nfiles; i++) {
+		memset(&xf, 0, sizeof(xf));
+		xf.path = toff;
+		xf.size = files[i].size;
+		xf.sec = files[i].mtim.tv_sec;
+		xf.nsec = files[i].mtim.tv_nsec;
+		fwrite(&xf, sizeof(xf), 1, fp);
+		toff += strlen(files[i].rel) + 1;
+	}
+	for (i = 0; i < n; i++) {
+		memset(&xw, 0, sizeof(xw));
+		xw.text = toff;
+		xw.len = ws[i]->len;
+		xw.post = poff;
+		xw.plen = ws[i]->post.len;
+		fwrite(&xw, sizeof(xw), 1, fp);
+		toff += ws[i]->len;
+		poff += ws[i]->post.len;
+	}
+	for (i = 0; i < nt; i++) {
+		memset(&xt, 0, sizeof(xt));
+		xt.key = ts[i]->key;
+		xt.post = poff;
+		xt.plen = ts[i]->post.len;
+		fwrite(&xt, sizeof(xt), 1, fp);
+		poff += ts[i]->post.len;
+	}
+	for (i = 0; i < nfiles; i++)
+		fwrite(files[i].rel, strlen(files[i].rel) + 1, 1, fp);
+	for (i = 0; i < n; i++)
+		fwrite(ws[i]->text, ws[i]->len, 1, fp);
+	for (i = 0; i < n; i++) {
+		w = ws[i];
+		fwrite(w->post.p, w->post.len, 1, fp);
+		free(w->post.p);
+		free(w->text);
+		free(w);
+	}
+	for (i = 0; i < nt; i++) {
+		t = ts[i];
+		fwrite(t->post.p, t->post.len, 1, fp);
+		free(t->post.p);
+		free(t);
+	}
+	if ((0 != ferror(fp)) || (0 != fclose(fp)) || (-1 == rename(tmp, idx)))
+		fatal("%s: cannot write %s\n", getprogname(), idx);
+	if (verbose)
+		fprintf(stderr, "%s: %s: %zu files, %u words, %u trigrams\n",
+		    getprogname(), idx, nfiles, n, nt);
+
+	free(ws);
+	free(ts);
+	free(wtab);
+	free(ttab);
+	free(idx);
+	free(tmp);
+}
+
+/*
+ * Whether the tables of the index img, len bytes, fit in it, and every
+ * path, slice and posting list they point at lies within it.
+ */
+static int
+ixcheck(const char *img, size_t len)
+{
+	const struct ixhdr *h = (const struct ixhdr *)img;
+	const struct ixfile *xf;
+	const struct ixword *xw;
+	const struct ixtri *xt;
+	uint32_t i;
+
+	if (len < sizeof(*h) + sizeof(*xf) * (uint64_t)h->nfile +
+	    sizeof(*xw) * (uint64_t)h->nword + sizeof(*xt) * (uint64_t)h->ntri)
+		return 0;
+	xf = (const struct ixfile *)(h + 1);
+	xw = (const struct ixword *)(xf + h->nfile);
+	xt = (const struct ixtri *)(xw + h->nword);
+	for (i = 0; i < h->nfile; i++)
+		if (xf[i].path >= len ||
+		    NULL == memchr(img + xf[i].path, '\0', len - xf[i].path))
+			return 0;
+	for (i = 0; i < h->nword; i++)
+		if (xw[i].text > len || xw[i].len > len - xw[i].text ||
+		    xw[i].post > len || xw[i].plen > len - xw[i].post)
+			return 0;
+	for (i = 0; i < h->ntri; i++)
+		if (xt[i].post > len || xt[i].plen > len - xt[i].post)
+			return 0;
+	return 1;
+}
+
+/*
+ * Map in dir/.cgrepidx, setting *idxp to its name and *lenp to its size.
+ */
+static char *
+ixopen(const char *dir, char **idxp, size_t *lenp)
+{
+	const struct ixhdr *h;
+	struct stat st;
+	char *img;
+	int fd;
+
+	if (-1 == asprintf(idxp, "%s/%s", dir, IX_NAME))
+		fatal(outSpace);
+	if ((-1 == (fd = open(*idxp, O_RDONLY))) || (-1 == fstat(fd, &st)))
+		fatal("%s: no index %s, use --index build\n", getprogname(),
+		    *idxp);
+	img = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == img || (size_t)st.st_size < sizeof(*h))
+		fatal("%s: cannot map %s\n", getprogname(), *idxp);
+	close(fd);
+
+	h = (const struct ixhdr *)img;
+	if ((IX_MAGIC != h->magic) || (IX_VERSION != h->version) ||
+	    (h->size != (uint64_t)st.st_size))
+		fatal("%s: %s is not a current index, use --index build\n",
+		    getprogname(), *idxp);
+	if (!ixcheck(img, st.st_size))
+		fatal("%s: %s is damaged, use --index build\n",
+		    getprogname(), *idxp);
+	*lenp = st.st_size;
+	return img;
+}
+
+/*
+ * Step *jp through the index files to the walked file i. Returns 1 if
+ * the index has it as it is now.
+ */
+static int
+fresh(const char *img, size_t i, uint32_t *jp)
+{
+	const struct ixhdr *h = (const struct ixhdr *)img;
+	const struct ixfile *xf = (const struct ixfile *)(h + 1);
+	uint32_t j;
+	int r = 1;
+
+	for (j = *jp; j < h->nfile &&
+	    (r = strcmp(img + xf[j].path, files[i].rel)) < 0; j++)
+		;
+	*jp = j;
+	return 0 == r && xf[j].size == files[i].size &&
+	    xf[j].sec == files[i].mtim.tv_sec &&
+	    xf[j].nsec == files[i].mtim.tv_nsec;
+}
+
+static int
+hitcmp(const void *a, const void *b)
+{
+	const struct hit *x = a, *y = b;
+
+	if (x->file != y->file)
+		return (x->file > y->file) - (x->file < y->file);
+	return (x->line > y->line) - (x->line < y->line);
+}
+
+/*
+ * Answer the pattern for the sources under dir from dir/.cgrepidx.
+ */
+void
+ixquery(const char *dir)
+{
+	const struct ixhdr *h;
+	const struct ixword *xw;
+	const unsigned char *p, *q, *end;
+	struct hit *hits = NULL;
+	uint32_t *lines = NULL;
+	size_t nhit = 0, hitLen = 0, linesLen = 0;
+	size_t i, k, len, stale = 0;
+	uint32_t f, l, j;
+	char *idx, *img;
+
+	img = ixopen(dir, &idx, &len);
+	h = (const struct ixhdr *)img;
+	xw = (const struct ixword *)((const struct ixfile *)(h + 1) + h->nfile);
+
+	/* the dictionary pass */
+	for (i = 0; i < h->nword; i++) {
+		if (!match(img + xw[i].text, xw[i].len))
+			continue;
+		p = (const unsigned char *)img + xw[i].post;
+		end = p + xw[i].plen;
+		for (f = l = 0; p < end; ) {
+			q = p;
+			if (!skipv(&q, end) || !skipv(&q, end))
+				fatal("%s: %s is damaged, use --index build\n",
+				    getprogname(), idx);
+			if (0 != (k = getv(&p))) {
+				f += k;
+				l = getv(&p);
+			}
+			else
+				l += getv(&p);
+			TROOM(hits, hitLen, nhit);
+			hits[nhit].file = f;
+			hits[nhit++].line = l;
+		}
+	}
+	qsort(hits, nhit, sizeof(*hits), hitcmp);
+
+	/* walk the tree, printing fresh files and lexing the rest */
+	walk(dir);
+	for (i = j = k = 0; i < nfiles; i++) {
+		filen = files[i].path;
+		if (!fresh(img, i, &j)) {
+			stale++;
+			lex();
+			continue;
+		}
+
+		while (k < nhit && hits[k].file < j)
+			k++;
+		for (l = 0; k < nhit && hits[k].file == j; k++) {
+			if (0 != l && lines[l - 1] == hits[k].line)
+				continue;
+			TROOM(lines, linesLen, l);
+			lines[l++] = hits[k].line;
+		}
+		if (0 != l)
+			printlines(lines, l);
+	}
+	if (verbose)
+		fprintf(stderr, "%s: %s: %u words, %zu postings, "
+		    "%zu files lexed\n", getprogname(), idx, h->nword, nhit,
+		    stale);
+
+	munmap(img, len);
+	free(hits);
+	free(lines);
+	free(idx);
+}
+
+/*
+ * Skip the group or class at p, returning what follows.
+ */
+static const char *
+skipgroup(const char *p)
+{
+	int depth = 0;
+
+	do {
+		switch (*p) {
+		case '\\':
+			if ('\0' != p[1])
+				p++;
+			break;
+		case '[':
+			if ('^' == *++p)
+				p++;
+			if (']' == *p)
+				p++;
+			while ('\0' != *p && ']' != *p)
+				p++;
+			break;
+		case '(':
+			depth++;
+			break;
+		case ')':
+			depth--;
+			break;
+		}
+		if ('\0' != *p)
+			p++;
+	} while (depth > 0 && '\0' != *p);
+	return p;
+}
+
+/*
+ * Put in tris the trigrams any text matching pat is sure to contain, as
+ * far as a plain reading tells: those of runs of ordinary characters not
+ * made optional by * or ?. Groups and classes are passed over. Returns
+ * -1 if pat has an | outside groups, as then no trigram is sure.
+ */
+static int
+need(const char *pat, uint32_t **tris, size_t *ntri, size_t *trisLen)
+{
+	unsigned char *run;
+	size_t n = 0, i;
+	int ch;
+
+	run = alloc(strlen(pat) + 1);
+	for (;;) {
+		ch = -1;
+		switch (*pat) {
+		case '|':
+			free(run);
+			return -1;
+		case '(':
+		case '[':
+			pat = skipgroup(pat);
+			if ('\0' != *pat && NULL != strchr("*+?", *pat))
+				pat++;
+			break;
+		case '\\':
+			if ('\0' != pat[1]) {
+				ch = (unsigned char)pat[1];
+				pat += 2;
+			}
+			else
+				pat++;
+			break;
+		case '\0':
+			break;
+		default:
+			if (NULL == strchr(".^$*+?)", *pat))
+				ch = (unsigned char)*pat;
+			pat++;
+		}
+
+		if (-1 != ch && '*' != *pat && '?' != *pat) {
+			run[n++] = ch;
+			if ('+' != *pat)
+				continue;
+		}
+
+		/* end of a run */
+		for (i = 0; i + 2 < n; i++) {
+			TROOM(*tris, *trisLen, *ntri);
+			(*tris)[(*ntri)++] = run[i] << 16 | run[i + 1] << 8 |
+			    run[i + 2];
+		}
+		n = 0;
+		if ('\0' == *pat)
+			break;
+	}
+	free(run);
+	return 0;
+}
+
+/*
+ * Binary search the n trigrams at xt for key.
+ */
+static const struct ixtri *
+trifind(const struct ixtri *xt, uint32_t n, uint32_t key)
+{
+	uint32_t lo = 0, hi = n, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (xt[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo < n && xt[lo].key == key) ? &xt[lo] : NULL;
+}
+
+/*
+ * Lex the sources under dir that may have strings (kinds & 1) or
+ * comments (kinds & 2) matching pat, using the trigrams in dir/.cgrepidx
+ * to pass over the rest. With no pat every file is lexed.
+ */
+void
+ixtquery(const char *dir, const char *pat, int kinds)
+{
+	const struct ixhdr *h;
+	const struct ixtri *xt, *e;
+	const unsigned char *p, *q, *end;
+	unsigned char *cand, *has;
+	uint32_t *tris = NULL, key, f, j;
+	size_t ntri = 0, trisLen = 0, len, i, lexed = 0;
+	int kind, all;
+	char *idx, *img;
+
+	img = ixopen(dir, &idx, &len);
+	h = (const struct ixhdr *)img;
+	xt = (const struct ixtri *)((const struct ixword *)
+	    ((const struct ixfile *)(h + 1) + h->nfile) + h->nword);
+
+	/* files with all the trigrams for some kind wanted */
+	all = (NULL == pat) || (-1 == need(pat, &tris, &ntri, &trisLen)) ||
+	    (0 == ntri);
+	cand = alloc(h->nfile + 1);
+	has = alloc(h->nfile + 1);
+	for (kind = 0; !all && kind < 2; kind++) {
+		if (!(kinds & (1 << kind)))
+			continue;
+		memset(has, 1, h->nfile);
+		for (i = 0; i < ntri; i++) {
+			key = kind << 24 | tris[i];
+			if (NULL == (e = trifind(xt, h->ntri, key))) {
+				memset(has, 0, h->nfile);
+				break;
+			}
+			p = (const unsigned char *)img + e->post;
+			end = p + e->plen;
+			for (f = 0, j = 0; p < end; ) {
+				q = p;
+				if (!skipv(&q, end) ||
+				    (f += getv(&p)) >= h->nfile)
+					fatal("%s: %s is damaged, use --index "
+					    "build\n", getprogname(), idx);
+				for (; j < f; j++)
+					has[j] = 0;
+				j = f + 1;
+			}
+			for (; j < h->nfile; j++)
+				has[j] = 0;
+		}
+		for (j = 0; j < h->nfile; j++)
+			cand[j] |= has[j];
+	}
+
+	walk(dir);
+	for (i = j = 0; i < nfiles; i++) {
+		if (!all && fresh(img, i, &j) && !cand[j])
+			continue;
+		filen = files[i].path;
+		lexed++;
+		lex();
+	}
+	if (verbose)
+		fprintf(stderr, "%s: %s: %zu trigrams needed, %zu of %zu "
+		    "files lexed\n", getprogname(), idx, all ? 0 : ntri, lexed,
+		    nfiles);
+
+	munmap(img, len);
+	free(cand);
+	free(has);
+	free(tris);
+	free(idx);
+}
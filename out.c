@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Output.
+ *
+ * Hits are gathered in one large buffer and written to stdout with
+ * write(2) when it fills, with line numbers formatted here, rather than
+ * paying for stdio's locking and format parsing on every hit. On a
+ * terminal the buffer goes out at each newline, so hits show as found.
+ * Each process (a --tags worker, a --serve child) has its own buffer,
+ * so it must be empty when they fork.
+ *
+ * What is written is kept as a list of iovecs for writev(2). Most
+ * point into the buffer, but oref() adds bytes where they lie, such as
+ * a hit line in the mapped input, so only the prefixes are copied. The
+ * owner of such bytes calls orelease() before they go away.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "cgrep.h"
+
+#define OBUFSIZ	(128 * 1024)
+#define OIOVS	256		/* iovecs per writev(), under IOV_MAX */
+
+static char obuf[OBUFSIZ];
+static size_t olen;
+static struct iovec oiov[OIOVS];
+static int niov;
+static int nref;		/* of oiov not in obuf */
+static int otty = -1;		/* stdout is a terminal, once known */
+
+/*
+ * Write out what is gathered. Output that can't be written is dropped,
+ * as stdio would.
+ */
+void
+oflush(void)
+{
+	struct iovec *v = oiov;
+	ssize_t n;
+	int left = niov;
+
+	while (left > 0) {
+		if (-1 == (n = writev(STDOUT_FILENO, v, left))) {
+			if (EINTR == errno)
+				continue;
+			break;
+		}
+		for (; left > 0 && (size_t)n >= v->iov_len; v++, left--)
+			n -= v->iov_len;
+		if (left > 0) {		/* part of one went */
+			v->iov_base = (char *)v->iov_base + n;
+			v->iov_len -= n;
+		}
+	}
+	olen = 0;
+	niov = nref = 0;
+}
+
+/*
+ * Bytes referred to by oref() are about to change or go.
+ */
+void
+orelease(void)
+{
+	if (nref > 0)
+		oflush();
+}
+
+/*
+ * Add the n bytes at s.
+ */
+void
+owrite(const void *s, size_t n)
+{
+	struct iovec *v;
+	size_t k;
+
+	if (-1 == otty)
+		otty = isatty(STDOUT_FILENO);
+	while (n > 0) {
+		if (OBUFSIZ == olen || OIOVS == niov)
+			oflush();
+		k = (n < OBUFSIZ - olen) ? n : OBUFSIZ - olen;
+		memcpy(obuf + olen, s, k);
+
+		/* grow the last iovec if it ends where these start */
+		v = oiov + niov;
+		if (0 == niov ||
+		    (char *)v[-1].iov_base + v[-1].iov_len != obuf + olen) {
+			niov++;
+			v->iov_base = obuf + olen;
+			v->iov_len = 0;
+		}
+		else
+			v--;
+		v->iov_len += k;
+		olen += k;
+		s = (const char *)s + k;
+		n -= k;
+	}
+	if (otty && niov > 0 && '\n' == *((char *)oiov[niov - 1].iov_base +
+	    oiov[niov - 1].iov_len - 1))
+		oflush();
+}
+
+/*
+ * Add the n bytes at s without copying them: they must stay as they
+ * are until written, or orelease() is called.
+ */
+void
+oref(const void *s, size_t n)
+{
+	struct iovec *v;
+
+	if (0 == n)
+		return;
+	if (-1 == otty)
+		otty = isatty(STDOUT_FILENO);
+	if (OIOVS == niov)
+		oflush();
+	v = &oiov[niov++];
+	v->iov_base = (void *)s;
+	v->iov_len = n;
+	nref++;
+	if (otty && '\n' == ((const char *)s)[n - 1])
+		oflush();
+}
+
+void
+oputs(const char *s)
+{
+	owrite(s, strlen(s));
+}
+
+/*
+ * Add v in decimal, right aligned in width columns like %*d.
+ */
+void
+onum(long v, int width)
+{
+	char buf[24], *p = buf + sizeof(buf);
+	unsigned long u = (v < 0) ? -(unsigned long)v : (unsigned long)v;
+
+	do
+		*--p = '0' + u % 10;
+	while (0 != (u /= 10));
+	if (v < 0)
+		*--p = '-';
+	while (buf + sizeof(buf) - p < width && p > buf)
+		*--p = ' ';
+	owrite(p, buf + sizeof(buf) - p);
+}
+
+/*
+ * Add the n bytes at s as a JSON string. Bytes from 0x80 up are passed
+ * as they are.
+ */
+void
+ojson(const char *s, size_t n)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *end = s + n, *p;
+	char esc[6] = { '\\', 'u', '0', '0' };
+
+	owrite("\"", 1);
+	for (p = s; p < end; p++) {
+		if ('"' != *p && '\\' != *p && (unsigned char)*p >= ' ')
+			continue;
+		owrite(s, p - s);
+		s = p + 1;
+		if ('"' == *p || '\\' == *p) {
+			esc[1] = *p;
+			owrite(esc, 2);
+			esc[1] = 'u';
+		}
+		else {
+			esc[4] = hex[(unsigned char)*p >> 4];
+			esc[5] = hex[*p & 0xf];
+			owrite(esc, 6);
+		}
+	}
+	owrite(s, p - s);
+	owrite("\"", 1);
+}
@@ -0,0 +1,564 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Pattern sets.
+ *
+ * A pattern set is a list of patterns any one of which makes a hit.
+ * Patterns without metacharacters, such as plain identifiers or
+ * "structure\.member", go into a hash table and cost one lookup however
+ * many there are. The rest are compiled with regcomp() and tried in turn.
+ *
+ * A finished set lives in one position-independent image: a header, the
+ * hash table, a directory of regular expressions, the literal strings and
+ * the regexp programs, all addressed by offsets from the start of the
+ * image. --compile-patterns writes the image out as is and --patterns
+ * maps it back in, so nothing is compiled at startup.
+ *
+ * psmatch() is a small meta-engine over two ways of running the set:
+ * direct, which tries every slice against the set, and memo, which
+ * remembers the answer for each distinct slice. Identifiers repeat a
+ * lot, so memo wins for patterns that backtrack, but for cheap patterns
+ * the hashing costs more than it saves. The set starts direct and
+ * counts the regexp steps (regsteps) of the first SAMPLE calls. If
+ * there are few, there is little for memo to save and direct is kept
+ * without timing anything else; otherwise memo is tried for as many
+ * more calls, and kept only if it was faster and saved steps too, so
+ * timing noise alone cannot choose it.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "regexp.h"
+#include "cgrep.h"
+
+#define CGP_MAGIC	0x0a504743	/* "CGP\n" read as a native integer */
+#define CGP_VERSION	2	/* 2: NSUBEXP 11 moved CLOSE */
+#define CGP_NOMUST	0xffffffff	/* regexp has no regmust */
+
+#define ALIGN4(n)	(((n) + 3) & ~(size_t)3)
+
+#define SAMPLE		4096	/* calls timed for each engine */
+#define CHEAP		8	/* steps per call not worth trying memo for */
+#define MEMOSLOTS	(1 << 16)	/* memo entries before starting over */
+
+struct cgphdr {		/* start of a pattern set image */
+	uint32_t magic;		/* CGP_MAGIC, also catches byte order */
+	uint32_t version;	/* CGP_VERSION */
+	uint32_t sum;		/* fnv() of everything after the header */
+	uint32_t size;		/* bytes in the whole image */
+	uint32_t hsize;		/* hash slots, a power of two */
+	uint32_t nlit;		/* literal patterns */
+	uint32_t nre;		/* regular expression patterns */
+	uint32_t pad;
+};
+
+struct cgplit {		/* a literal pattern in the image */
+	uint32_t len;		/* bytes of text following */
+};
+
+struct cgpre {		/* a regular expression in the image */
+	uint32_t plen;		/* bytes of program following */
+	uint32_t must;		/* regmust offset in program or CGP_NOMUST */
+	uint32_t mlen;		/* regmlen */
+	char start;		/* regstart */
+	char anch;		/* reganch */
+	char pad[2];
+};
+
+enum engine {		/* how psmatch() runs the set */
+	tdirect,	/* timing direct */
+	tmemo,		/* timing memo */
+	direct,		/* settled on direct */
+	memo		/* settled on memo */
+};
+
+struct memoent {	/* a remembered slice, text follows */
+	uint32_t hash;
+	uint32_t len;
+	int hit;
+};
+
+struct patset {
+	char *img;		/* the image, NULL while building */
+	const uint32_t *htab;	/* literal offsets in img, 0 is empty */
+	uint32_t hmask;		/* hsize - 1 */
+	regexp **re;		/* regexps, programs inside img */
+	int nre;
+
+	/* while building */
+	char **lits;		/* literal patterns */
+	int nlit, litLen;
+	regexp **res;		/* compiled regexps */
+	int nres, resLen;
+
+	/* meta-engine */
+	enum engine eng;	/* current engine */
+	long calls;		/* calls timed so far */
+	long steps;		/* regsteps spent in them */
+	long ns;		/* and the time */
+	long directNs;		/* ns per call direct */
+	long directSteps;	/* and steps */
+	uint32_t *mslot;	/* memo offsets in marena + 1, 0 is empty */
+	uint32_t mcount;	/* memo entries */
+	char *marena;		/* memo entries */
+	size_t mused, mhas;	/* bytes used and allocated in marena */
+};
+
+/*
+ * If pat is free of metacharacters other than backslash escapes, put
+ * its text in lit and return the length, else return -1.
+ */
+static int
+literal(const char *pat, char *lit)
+{
+	char *p = lit;
+
+	for (; '\0' != *pat; pat++) {
+		if ('\\' == *pat) {
+			if ('\0' == *++pat)
+				return -1;
+		}
+		else if (NULL != strchr("^$.[()|?+*", *pat))
+			return -1;
+		*p++ = *pat;
+	}
+	return p - lit;
+}
+
+/*
+ * Start building an empty pattern set.
+ */
+struct patset *
+psnew(void)
+{
+	return alloc(sizeof(struct patset));
+}
+
+/*
+ * Add a pattern, which like a command line pattern must match a
+ * whole identifier or chain.
+ */
+void
+psadd(struct patset *ps, const char *pat)
+{
+	char *p;
+	int n;
+
+	p = alloc(5 + strlen(pat));
+	if (-1 != (n = literal(pat, p))) {
+		if (0 == n) {	/* can't match any identifier */
+			free(p);
+			return;
+		}
+		p[n] = '\0';
+		TROOM(ps->lits, ps->litLen, ps->nlit);
+		ps->lits[ps->nlit++] = p;
+		return;
+	}
+
+	/* inclose pattern in ^(  )$ to force full match */
+	sprintf(p, "^(%s)$", pat);
+	TROOM(ps->res, ps->resLen, ps->nres);
+	if (NULL == (ps->res[ps->nres++] = regcomp(p)))
+		fatal("Illegal pattern\n");
+	free(p);
+}
+
+/*
+ * Is the size byte image, read from a file, safe to attach? Every hash
+ * slot and directory entry must point at a record lying wholly inside
+ * it, with an empty slot left to end probing, and every program must be
+ * well formed.
+ */
+static int
+pscheck(const char *img, size_t size)
+{
+	const struct cgphdr *h = (const struct cgphdr *)img;
+	const uint32_t *htab = (const uint32_t *)(h + 1), *dir;
+	const struct cgplit *cl;
+	const struct cgpre *cr;
+	uint64_t first;
+	uint32_t i, off, nlit = 0;
+
+	if (0 == h->hsize || 0 != (h->hsize & (h->hsize - 1)))
+		return 0;
+	first = sizeof(*h) + sizeof(uint32_t) * ((uint64_t)h->hsize + h->nre);
+	if (first > size)
+		return 0;
+	dir = htab + h->hsize;
+	for (i = 0; i < h->hsize; i++) {
+		if (0 == (off = htab[i]))
+			continue;
+		if (off < first || off > size || 0 != (off & 3) ||
+		    size - off < sizeof(*cl))
+			return 0;
+		cl = (const struct cgplit *)(img + off);
+		if (size - off - sizeof(*cl) < cl->len)
+			return 0;
+		nlit++;
+	}
+	if (nlit != h->nlit || nlit >= h->hsize)
+		return 0;
+	for (i = 0; i < h->nre; i++) {
+		off = dir[i];
+		if (off < first || off > size || 0 != (off & 3) ||
+		    size - off < sizeof(*cr))
+			return 0;
+		cr = (const struct cgpre *)(img + off);
+		if (size - off - sizeof(*cr) < cr->plen ||
+		    (CGP_NOMUST != cr->must && (cr->must >= cr->plen ||
+		    cr->plen - cr->must < cr->mlen)) ||
+		    !regvalid((const char *)(cr + 1), cr->plen))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Point the set at its image, which must already be checked.
+ */
+static void
+psattach(struct patset *ps, char *img)
+{
+	const struct cgphdr *h = (const struct cgphdr *)img;
+	const uint32_t *dir;
+	const struct cgpre *cr;
+	regexp *r;
+	uint32_t i;
+
+	ps->img = img;
+	ps->eng = h->nre ? tdirect : direct;	/* hashing needs no memo */
+	ps->htab = (const uint32_t *)(h + 1);
+	ps->hmask = h->hsize - 1;
+	dir = ps->htab + h->hsize;
+	ps->nre = h->nre;
+	ps->re = alloc(sizeof(regexp *) * (h->nre + 1));
+	for (i = 0; i < h->nre; i++) {
+		cr = (const struct cgpre *)(img + dir[i]);
+		ps->re[i] = r = alloc(sizeof(regexp));
+		r->program = (char *)(cr + 1);
+		r->regplen = cr->plen;
+		r->regstart = cr->start;
+		r->reganch = cr->anch;
+		r->regmust = (CGP_NOMUST == cr->must) ? NULL :
+		    r->program + cr->must;
+		r->regmlen = cr->mlen;
+	}
+}
+
+/*
+ * Lay the patterns added so far out in an image, after which the set
+ * can be matched and written but not added to.
+ */
+void
+psfreeze(struct patset *ps)
+{
+	struct cgphdr *h;
+	struct cgplit *cl;
+	struct cgpre *cr;
+	uint32_t *htab, *dir, hsize, slot;
+	size_t size, off, n;
+	regexp *r;
+	int i;
+
+	for (hsize = 1; hsize < 2 * (uint32_t)ps->nlit + 1; hsize <<= 1)
+		;
+
+	size = sizeof(*h) + sizeof(uint32_t) * (hsize + ps->nres);
+	for (i = 0; i < ps->nlit; i++)
+		size += ALIGN4(sizeof(*cl) + strlen(ps->lits[i]));
+	for (i = 0; i < ps->nres; i++)
+		size += ALIGN4(sizeof(*cr) + ps->res[i]->regplen);
+
+	h = alloc(size);
+	h->magic = CGP_MAGIC;
+	h->version = CGP_VERSION;
+	h->size = size;
+	h->hsize = hsize;
+	h->nlit = 0;
+	h->nre = ps->nres;
+	htab = (uint32_t *)(h + 1);
+	dir = htab + hsize;
+	off = (char *)(dir + ps->nres) - (char *)h;
+
+	for (i = 0; i < ps->nlit; i++) {
+		n = strlen(ps->lits[i]);
+		for (slot = fnv(ps->lits[i], n) & (hsize - 1); htab[slot];
+		    slot = (slot + 1) & (hsize - 1)) {
+			cl = (struct cgplit *)((char *)h + htab[slot]);
+			if (cl->len == n && !memcmp(cl + 1, ps->lits[i], n))
+				break;
+		}
+		if (0 == htab[slot]) {	/* not a duplicate */
+			cl = (struct cgplit *)((char *)h + off);
+			cl->len = n;
+			memcpy(cl + 1, ps->lits[i], n);
+			htab[slot] = off;
+			off += ALIGN4(sizeof(*cl) + n);
+			h->nlit++;
+		}
+		free(ps->lits[i]);
+	}
+
+	for (i = 0; i < ps->nres; i++) {
+		r = ps->res[i];
+		cr = (struct cgpre *)((char *)h + off);
+		cr->plen = r->regplen;
+		cr->must = (NULL == r->regmust) ? CGP_NOMUST :
+		    r->regmust - r->program;
+		cr->mlen = r->regmlen;
+		cr->start = r->regstart;
+		cr->anch = r->reganch;
+		memcpy(cr + 1, r->program, r->regplen);
+		dir[i] = off;
+		off += ALIGN4(sizeof(*cr) + r->regplen);
+		free(r);
+	}
+
+	h->size = off;
+	h->sum = fnv(h + 1, off - sizeof(*h));
+	free(ps->lits);
+	free(ps->res);
+	ps->lits = NULL;
+	ps->res = NULL;
+	psattach(ps, (char *)h);
+}
+
+/*
+ * Does the slice p, n fully match any pattern in the set?
+ * This is the direct engine.
+ */
+static int
+psexec(const struct patset *ps, const char *p, size_t n)
+{
+	const struct cgplit *cl;
+	uint32_t slot;
+	int i;
+
+	if (ps->hmask) {
+		for (slot = fnv(p, n) & ps->hmask; ps->htab[slot];
+		    slot = (slot + 1) & ps->hmask) {
+			cl = (const struct cgplit *)(ps->img + ps->htab[slot]);
+			if (cl->len == n && !memcmp(cl + 1, p, n))
+				return 1;
+		}
+	}
+
+	for (i = 0; i < ps->nre; i++)
+		if (regnexec(ps->re[i], p, n))
+			return 1;
+	return 0;
+}
+
+/*
+ * The regular expression in the set that fully matches the slice p, n,
+ * with its startp and endp set, or NULL if only a literal does. For -r
+ * substitution, once psmatch() has found a hit.
+ */
+regexp *
+psfind(struct patset *ps, const char *p, size_t n)
+{
+	int i;
+
+	for (i = 0; i < ps->nre; i++)
+		if (regnexec(ps->re[i], p, n))
+			return ps->re[i];
+	return NULL;
+}
+
+/*
+ * The memo engine: look the slice up, running the set on a miss.
+ */
+static int
+psmemo(struct patset *ps, const char *p, size_t n)
+{
+	struct memoent *me;
+	uint32_t h, slot;
+
+	if (NULL == ps->mslot || ps->mcount >= MEMOSLOTS / 2) {
+		if (NULL == ps->mslot)	/* first use */
+			ps->mslot = alloc(sizeof(uint32_t) * MEMOSLOTS);
+		else			/* full, start over */
+			memset(ps->mslot, 0, sizeof(uint32_t) * MEMOSLOTS);
+		ps->mcount = 0;
+		ps->mused = 0;
+	}
+
+	h = fnv(p, n);
+	for (slot = h & (MEMOSLOTS - 1); ps->mslot[slot];
+	    slot = (slot + 1) & (MEMOSLOTS - 1)) {
+		me = (struct memoent *)(ps->marena + ps->mslot[slot] - 1);
+		if (me->hash == h && me->len == n && !memcmp(me + 1, p, n))
+			return me->hit;
+	}
+
+	ROOM(ps->marena, ps->mhas, ps->mused + ALIGN4(sizeof(*me) + n));
+	me = (struct memoent *)(ps->marena + ps->mused);
+	me->hash = h;
+	me->len = n;
+	me->hit = psexec(ps, p, n);
+	memcpy(me + 1, p, n);
+	ps->mslot[slot] = ps->mused + 1;
+	ps->mused += ALIGN4(sizeof(*me) + n);
+	ps->mcount++;
+	return me->hit;
+}
+
+/*
+ * Does the slice p, n fully match any pattern in the set?
+ * Runs whichever engine the set has settled on, timing them first.
+ */
+int
+psmatch(struct patset *ps, const char *p, size_t n)
+{
+	struct timespec t0, t1;
+	long steps;
+	int hit;
+
+	switch (ps->eng) {
+	case direct:
+		return psexec(ps, p, n);
+	case memo:
+		return psmemo(ps, p, n);
+	default:
+		break;
+	}
+
+	steps = regsteps;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	hit = (tdirect == ps->eng) ? psexec(ps, p, n) : psmemo(ps, p, n);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ps->ns += (t1.tv_sec - t0.tv_sec) * 1000000000L +
+	    (t1.tv_nsec - t0.tv_nsec);
+	ps->steps += regsteps - steps;
+	if (++ps->calls < SAMPLE)
+		return hit;
+
+	if (tdirect == ps->eng) {
+		ps->directNs = ps->ns / ps->calls;
+		ps->directSteps = ps->steps / ps->calls;
+		if (verbose)
+			fprintf(stderr, "%s: direct: %ld ns, %ld steps per "
+			    "call over %ld calls\n", getprogname(),
+			    ps->directNs, ps->directSteps, ps->calls);
+		ps->eng = (ps->directSteps < CHEAP) ? direct : tmemo;
+	}
+	else {
+		if (verbose)
+			fprintf(stderr, "%s: memo: %ld ns, %ld steps per "
+			    "call over %ld calls\n", getprogname(),
+			    ps->ns / ps->calls, ps->steps / ps->calls,
+			    ps->calls);
+		ps->eng = (ps->ns / ps->calls < ps->directNs &&
+		    ps->steps / ps->calls < ps->directSteps) ? memo : direct;
+	}
+	if (verbose && tmemo != ps->eng)
+		fprintf(stderr, "%s: using %s engine\n", getprogname(),
+		    (memo == ps->eng) ? "memo" : "direct");
+	if (direct == ps->eng) {	/* memo no longer needed */
+		free(ps->mslot);
+		free(ps->marena);
+		ps->mslot = NULL;
+		ps->marena = NULL;
+		ps->mhas = 0;
+	}
+	ps->calls = ps->steps = ps->ns = 0;
+	return hit;
+}
+
+/*
+ * The checksum of a frozen set, the same whenever the patterns are.
+ */
+uint32_t
+pssum(const struct patset *ps)
+{
+	return ((const struct cgphdr *)ps->img)->sum;
+}
+
+/*
+ * Write the image of a frozen set to file.
+ */
+void
+pswrite(const struct patset *ps, const char *file)
+{
+	const struct cgphdr *h = (const struct cgphdr *)ps->img;
+	FILE *fp;
+
+	if ((NULL == (fp = fopen(file, "w"))) ||
+	    (h->size != fwrite(h, 1, h->size, fp)) ||
+	    (0 != fclose(fp)))
+		fatal("%s: cannot write %s\n", getprogname(), file);
+}
+
+/*
+ * Map in a set written by pswrite(), checking its header.
+ */
+struct patset *
+psload(const char *file)
+{
+	const struct cgphdr *h;
+	struct patset *ps;
+	struct stat st;
+	char *img;
+	int fd;
+
+	if ((-1 == (fd = open(file, O_RDONLY))) || (-1 == fstat(fd, &st)))
+		fatal("%s: cannot open %s\n", getprogname(), file);
+	if ((size_t)st.st_size < sizeof(*h))
+		fatal("%s: %s is not a pattern file\n", getprogname(), file);
+	img = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == img)
+		fatal("%s: cannot map %s\n", getprogname(), file);
+	close(fd);
+
+	h = (const struct cgphdr *)img;
+	if (CGP_MAGIC != h->magic)
+		fatal("%s: %s is not a pattern file\n", getprogname(), file);
+	if (CGP_VERSION != h->version)
+		fatal("%s: %s is pattern file version %u, not %u\n",
+		    getprogname(), file, h->version, CGP_VERSION);
+	if ((h->size != st.st_size) ||
+	    (h->sum != fnv(h + 1, h->size - sizeof(*h))) ||
+	    !pscheck(img, st.st_size))
+		fatal("%s: %s is corrupt\n", getprogname(), file);
+
+	ps = psnew();
+	psattach(ps, img);
+	return ps;
+}
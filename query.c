@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+/*
+ * Boolean queries over several patterns, for --query.
+ *
+ * qcomp() parses an expression of patterns joined by AND, OR, NOT and
+ * NEAR into a tree. Each pattern, and each NEAR, gets a bit: while a
+ * file is lexed qslice(), as the slicehook, tries each slice against
+ * the patterns whose bits are not yet set and sets them, noting the
+ * line. The tree is only evaluated when a bit changes, in three values
+ * (true, false, not known yet), so lex() can give the file up as soon
+ * as the answer is known: a AND NOT b is decided false at the first b.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cgrep.h"
+
+#define QMAX	64	/* patterns and NEARs, one bit each */
+
+enum qop {
+	opterm,		/* a pattern */
+	opnear,		/* two patterns within lines of each other */
+	opnot,
+	opand,
+	opor
+};
+
+struct qnode {
+	enum qop op;
+	int a, b;		/* operands */
+	int no;			/* opterm, opnear: its bit number */
+	int lines;		/* opnear: how far apart */
+	struct patset *ps;	/* opterm: compiled */
+	char *src;		/* opterm: as given */
+	uint64_t nears;		/* opterm: bits of the NEARs it is in */
+};
+
+static struct qnode *nodes;
+static int nnode, nodesLen;
+static int root;
+static int nbit;		/* bits given out */
+
+static const char *qp;		/* parse position */
+static int tok;			/* lookahead: ( ) A O N R w or 0 */
+static char *tokw;		/* w: the pattern */
+static int toklines;		/* R: NEAR/lines */
+
+static uint64_t seen;		/* this file's bits */
+static int last[QMAX];		/* line each pattern was last found on */
+static int val;			/* qeval() of seen */
+
+/*
+ * Read the next token of the expression. A pattern runs to white space
+ * or a ) it did not open, or is put in double quotes.
+ */
+static void
+qnext(void)
+{
+	const char *s;
+	int depth = 0;
+	size_t n;
+
+	while (isspace((unsigned char)*qp))
+		qp++;
+	if ('\0' == *qp || '(' == *qp || ')' == *qp) {
+		tok = *qp;
+		if ('\0' != *qp)
+			qp++;
+		return;
+	}
+	if ('"' == *qp) {
+		s = ++qp;
+		if (NULL == (qp = strchr(s, '"')))
+			fatal("%s: --query: unmatched \"\n", getprogname());
+		n = qp++ - s;
+	}
+	else {
+		for (s = qp; '\0' != *qp && !isspace((unsigned char)*qp);
+		    qp++)
+			if ('\\' == *qp && '\0' != qp[1])
+				qp++;
+			else if ('(' == *qp)
+				depth++;
+			else if (')' == *qp && 0 == depth--)
+				break;
+		n = qp - s;
+		tok = 0;
+		if (3 == n && !strncmp(s, "AND", 3))
+			tok = 'A';
+		else if (2 == n && !strncmp(s, "OR", 2))
+			tok = 'O';
+		else if (3 == n && !strncmp(s, "NOT", 3))
+			tok = 'N';
+		else if (4 <= n && !strncmp(s, "NEAR", 4)) {
+			toklines = 0;
+			if (4 == n)
+				tok = 'R';
+			else if ('/' == s[4] && 5 < n &&
+			    n == 5 + strspn(s + 5, "0123456789")) {
+				toklines = atoi(s + 5);
+				tok = 'R';
+			}
+		}
+		if (0 != tok)
+			return;
+	}
+	tokw = alloc(n + 1);
+	memcpy(tokw, s, n);
+	tok = 'w';
+}
+
+static int
+qnode(enum qop op, int a, int b)
+{
+	TROOM(nodes, nodesLen, nnode);
+	memset(&nodes[nnode], 0, sizeof(nodes[nnode]));
+	nodes[nnode].op = op;
+	nodes[nnode].a = a;
+	nodes[nnode].b = b;
+	if (opterm == op || opnear == op) {
+		if (QMAX == nbit)
+			fatal("%s: --query: more than %d patterns and NEARs\n",
+			    getprogname(), QMAX);
+		nodes[nnode].no = nbit++;
+	}
+	return nnode++;
+}
+
+static int qor(void);
+
+/*
+ * A pattern, the same node each time it is named, or ( expression ).
+ */
+static int
+qprim(void)
+{
+	int i;
+
+	if ('(' == tok) {
+		qnext();
+		i = qor();
+		if (')' != tok)
+			fatal("%s: --query: missing )\n", getprogname());
+		qnext();
+		return i;
+	}
+	if ('w' != tok)
+		fatal("%s: --query: pattern expected\n", getprogname());
+	for (i = 0; i < nnode; i++)
+		if (opterm == nodes[i].op && !strcmp(nodes[i].src, tokw)) {
+			free(tokw);
+			qnext();
+			return i;
+		}
+	i = qnode(opterm, -1, -1);
+	nodes[i].src = tokw;
+	nodes[i].ps = psnew();
+	psadd(nodes[i].ps, tokw);
+	psfreeze(nodes[i].ps);
+	qnext();
+	return i;
+}
+
+/*
+ * Patterns joined by NEAR or NEAR/n.
+ */
+static int
+qprox(void)
+{
+	int a, b, lines;
+
+	a = qprim();
+	while ('R' == tok) {
+		lines = toklines;
+		qnext();
+		b = qprim();
+		if (opterm != nodes[a].op || opterm != nodes[b].op)
+			fatal("%s: --query: NEAR joins two patterns\n",
+			    getprogname());
+		a = qnode(opnear, a, b);
+		nodes[a].lines = lines;
+		nodes[nodes[a].a].nears |= (uint64_t)1 << nodes[a].no;
+		nodes[nodes[a].b].nears |= (uint64_t)1 << nodes[a].no;
+	}
+	return a;
+}
+
+static int
+qnot(void)
+{
+	if ('N' != tok)
+		return qprox();
+	qnext();
+	return qnode(opnot, qnot(), -1);
+}
+
+static int
+qand(void)
+{
+	int a;
+
+	a = qnot();
+	while ('A' == tok) {
+		qnext();
+		a = qnode(opand, a, qnot());
+	}
+	return a;
+}
+
+static int
+qor(void)
+{
+	int a;
+
+	a = qand();
+	while ('O' == tok) {
+		qnext();
+		a = qnode(opor, a, qand());
+	}
+	return a;
+}
+
+/*
+ * Compile the query expr.
+ */
+void
+qcomp(const char *expr)
+{
+	qp = expr;
+	qnext();
+	root = qor();
+	if (0 != tok)
+		fatal("%s: --query: junk at %s\n", getprogname(),
+		    ('w' == tok) ? tokw : qp - 1);
+}
+
+/*
+ * Node i for the bits in seen: 1, 0, or -1 if that is not known yet.
+ * At the end of the file, final, a bit not set never will be.
+ */
+static int
+qeval(int i, int final)
+{
+	const struct qnode *q = &nodes[i];
+	int a, b;
+
+	switch (q->op) {
+	case opnot:
+		a = qeval(q->a, final);
+		return (-1 == a) ? -1 : !a;
+	case opand:
+		if (0 == (a = qeval(q->a, final)) ||
+		    0 == (b = qeval(q->b, final)))
+			return 0;
+		return (1 == a && 1 == b) ? 1 : -1;
+	case opor:
+		if (1 == (a = qeval(q->a, final)) ||
+		    1 == (b = qeval(q->b, final)))
+			return 1;
+		return (0 == a && 0 == b) ? 0 : -1;
+	default:
+		if (seen & (uint64_t)1 << q->no)
+			return 1;
+		return final ? 0 : -1;
+	}
+}
+
+/*
+ * Start a file.
+ */
+void
+qstart(void)
+{
+	seen = 0;
+	memset(last, 0, sizeof(last));
+	val = qeval(root, 0);
+}
+
+/*
+ * The slicehook for --query: the slice p, n was found at line.
+ */
+void
+qslice(const char *p, size_t n, int line)
+{
+	const struct qnode *q, *o;
+	uint64_t was = seen, bit;
+	int i, j;
+
+	for (i = 0; i < nnode; i++) {
+		q = &nodes[i];
+		if (opterm != q->op)
+			continue;
+		bit = (uint64_t)1 << q->no;
+		if (((seen & bit) && 0 == (q->nears & ~seen)) ||
+		    last[q->no] == line || !psmatch(q->ps, p, n))
+			continue;
+		seen |= bit;
+		last[q->no] = line;
+		for (j = 0; 0 != (q->nears & ~seen) && j < nnode; j++) {
+			if (opnear != nodes[j].op ||
+			    (i != nodes[j].a && i != nodes[j].b))
+				continue;
+			o = &nodes[(i == nodes[j].a) ? nodes[j].b : nodes[j].a];
+			if (0 != last[o->no] &&
+			    line - last[o->no] <= nodes[j].lines)
+				seen |= (uint64_t)1 << nodes[j].no;
+		}
+	}
+	if (seen != was)
+		val = qeval(root, 0);
+}
+
+/*
+ * Is the query true of the file? -1 if that is not known yet; at the
+ * end of it, final, it is.
+ */
+int
+qresult(int final)
+{
+	return final ? qeval(root, 1) : val;
+}
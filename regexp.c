@@ -21,6 +21,7 @@
  ********* libmisc.a. The original is freely available on mwcbbs.
  *
  * 2019-11-28 Code adapted for standalone cgrep on modern NetBSD.
+ * Ten subexpressions, not nine: cgrep wraps every pattern in ^( )$.
  *
  * Beware that some of this code is subtly aware of the way operator
  * precedence is structured in regular expressions.  Serious changes in
@@ -40,6 +41,7 @@
  * reganch	is the match anchored (at beginning-of-line only)?
  * regmust	string (pointer into program) that match must include, or NULL
  * regmlen	length of regmust string
+ * regplen	length of the program, for saving it elsewhere
  *
  * Regstart and reganch permit very fast decisions on suitable starting points
  * for a match, cutting down the work a lot.  Regmust permits fast rejection
@@ -82,7 +84,7 @@
 #define	PLUS	11	/* node	Match this (simple) thing 1 or more times. */
 #define	OPEN	20	/* no	Mark this point in input as start of #n. */
 			/*	OPEN+1 is number 1, etc. */
-#define	CLOSE	30	/* no	Analogous to OPEN. */
+#define	CLOSE	31	/* no	Analogous to OPEN. */
 
 /*
  * Opcode notes:
@@ -117,7 +119,7 @@
  * but allows patterns to get big without disasters.
  */
 #define	OP(p)	(*(p))
-#define	NEXT(p)	(((*((p)+1)&0377)<<8) + *((p)+2)&0377)
+#define	NEXT(p)	(((*((p)+1)&0377)<<8) + (*((p)+2)&0377))
 #define	OPERAND(p)	((p) + 3)
 
 /*
@@ -218,6 +220,8 @@ char *exp;
 
 	/* Allocate space. */
 	r = (regexp *)calloc(1, sizeof(regexp) + (unsigned)regsize);
+	r->program = (char *)(r + 1);
+	r->regplen = regsize;
 
 	/* Second pass: emit code. */
 	regparse = exp;
@@ -680,9 +684,16 @@ char *val;
  */
 static char *reginput;		/* String-input pointer. */
 static char *regbol;		/* Beginning of input, for ^ check. */
+static char *regeol;		/* End of input, for $ check. */
 static char **regstartp;	/* Pointer to startp array. */
 static char **regendp;		/* Ditto for endp. */
 
+/*
+ * Nodes visited by regmatch(), a measure of the work (backtracking
+ * included) that a pattern costs.  Never reset here.
+ */
+long regsteps;
+
 /*
  * Forwards.
  */
@@ -697,14 +708,29 @@ STATIC char *regprop();
 #endif
 
 /*
- - regexec - match a regexp against a string
+ - regexec - match a regexp against a NUL-terminated string
  */
 int
-regexec(regexp *prog, char *string, int fromline)
+regexec(regexp *prog, char *string)
+{
+	if (string == NULL) {
+		regerror("NULL parameter");
+		return(0);
+	}
+	return(regnexec(prog, string, strlen(string)));
+}
+
+/*
+ - regnexec - match a regexp against the len bytes at string
+ *
+ * The slice need not be NUL-terminated and may contain NUL bytes; the end
+ * of input for $ and friends is string+len.
+ */
+int
+regnexec(regexp *prog, const char *string, size_t len)
 {
-	int		result;
 	register char *s;
-	extern char *strchr();
+	register char *end;
 
 	/* Be paranoid... */
 	if (prog == NULL || string == NULL) {
@@ -718,52 +744,47 @@ regexec(regexp *prog, char *string, int fromline)
 		return(0);
 	}
 
+	end = (char *)string + len;
+
 	/* If there is a "must appear" string, look for it. */
 	if (prog->regmust != NULL) {
-		s = string;
-		while ((s = strchr(s, prog->regmust[0])) != NULL) {
-			if (strncmp(s, prog->regmust, prog->regmlen) == 0)
+		s = (char *)string;
+		while (end - s >= prog->regmlen &&
+		    (s = memchr(s, prog->regmust[0], end - s)) != NULL) {
+			if (end - s >= prog->regmlen &&
+			    memcmp(s, prog->regmust, prog->regmlen) == 0)
 				break;	/* Found it. */
 			s++;
 		}
-		if (s == NULL) {	/* Not present. */
-			/* printf("return 0 from %d\n", fromline); */
+		if (s == NULL || end - s < prog->regmlen)	/* Not present. */
 			return(0);
-			}
 	}
 
-	/* Mark beginning of line for ^ . */
-	regbol = string;
+	/* Mark beginning and end of line for ^ and $. */
+	regbol = (char *)string;
+	regeol = end;
 
 	/* Simplest case:  anchored match need be tried only once. */
-	if (prog->reganch) {
-		result = regtry(prog, string);
-		/* printf("return %d from %d\n", result, fromline); */
-		return result;
-		}
+	if (prog->reganch)
+		return(regtry(prog, (char *)string));
 
 	/* Messy cases:  unanchored match. */
-	s = string;
-	if (prog->regstart != '\0')
+	s = (char *)string;
+	if (prog->regstart != '\0') {
 		/* We know what char it must start with. */
-		while ((s = strchr(s, prog->regstart)) != NULL) {
-			if (regtry(prog, s)) {
-				/* printf("return 1 from %d\n", fromline); */
+		while (s < end && (s = memchr(s, prog->regstart, end - s)) != NULL) {
+			if (regtry(prog, s))
 				return(1);
-				}
 			s++;
 		}
-	else
+	} else
 		/* We don't -- general case. */
 		do {
-			if (regtry(prog, s)) {
-				/* printf("return 1 from %d\n", fromline); */
+			if (regtry(prog, s))
 				return(1);
-				}
-		} while (*s++ != '\0');
+		} while (s++ < end);
 
 	/* Failure. */
-	/* printf("return 0 from %d\n", fromline); */
 	return(0);
 }
 
@@ -821,6 +842,7 @@ char *prog;
 		fprintf(stderr, "%s(\n", regprop(scan));
 #endif
 	while (scan != NULL) {
+		regsteps++;
 #ifdef DEBUG
 		if (regnarrate)
 			fprintf(stderr, "%s...\n", regprop(scan));
@@ -833,11 +855,11 @@ char *prog;
 				return(0);
 			break;
 		case EOL:
-			if (*reginput != '\0')
+			if (reginput != regeol)
 				return(0);
 			break;
 		case ANY:
-			if (*reginput == '\0')
+			if (reginput >= regeol)
 				return(0);
 			reginput++;
 			break;
@@ -847,22 +869,24 @@ char *prog;
 
 				opnd = OPERAND(scan);
 				/* Inline the first character, for speed. */
-				if (*opnd != *reginput)
+				if (reginput >= regeol || *opnd != *reginput)
 					return(0);
 				len = strlen(opnd);
-				if (len > 1 && strncmp(opnd, reginput, len) != 0)
+				if (len > regeol - reginput ||
+				    (len > 1 && memcmp(opnd, reginput, len) != 0))
 					return(0);
 				reginput += len;
 			}
 			break;
 		case ANYOF:
- 			if (*reginput == '\0' || strchr(OPERAND(scan), *reginput) == NULL)
+			if (reginput >= regeol || *reginput == '\0' ||
+			    strchr(OPERAND(scan), *reginput) == NULL)
 				return(0);
 			reginput++;
 			break;
 		case ANYBUT:
-			if (strchr(OPERAND(scan), *reginput) != NULL)
- 			if (*reginput == '\0' || strchr(OPERAND(scan), *reginput) != NULL)
+			if (reginput >= regeol || (*reginput != '\0' &&
+			    strchr(OPERAND(scan), *reginput) != NULL))
 				return(0);
 			reginput++;
 			break;
@@ -878,7 +902,8 @@ char *prog;
 		case OPEN+6:
 		case OPEN+7:
 		case OPEN+8:
-		case OPEN+9: {
+		case OPEN+9:
+		case OPEN+10: {
 				register int no;
 				register char *save;
 
@@ -906,7 +931,8 @@ char *prog;
 		case CLOSE+6:
 		case CLOSE+7:
 		case CLOSE+8:
-		case CLOSE+9: {
+		case CLOSE+9:
+		case CLOSE+10: {
 				register int no;
 				register char *save;
 
@@ -963,7 +989,8 @@ char *prog;
 				no = regrepeat(OPERAND(scan));
 				while (no >= min) {
 					/* If it could work, try it. */
-					if (nextch == '\0' || *reginput == nextch)
+					if (nextch == '\0' ||
+					    (reginput < regeol && *reginput == nextch))
 						if (regmatch(next))
 							return(1);
 					/* Couldn't or didn't -- back up. */
@@ -1008,23 +1035,25 @@ char *p;
 	opnd = OPERAND(p);
 	switch (OP(p)) {
 	case ANY:
-		count = strlen(scan);
+		count = regeol - scan;
 		scan += count;
 		break;
 	case EXACTLY:
-		while (*opnd == *scan) {
+		while (scan < regeol && *opnd == *scan) {
 			count++;
 			scan++;
 		}
 		break;
 	case ANYOF:
-		while (*scan != '\0' && strchr(opnd, *scan) != NULL) {
+		while (scan < regeol && *scan != '\0' &&
+		    strchr(opnd, *scan) != NULL) {
 			count++;
 			scan++;
 		}
 		break;
 	case ANYBUT:
-		while (*scan != '\0' && strchr(opnd, *scan) == NULL) {
+		while (scan < regeol && (*scan == '\0' ||
+		    strchr(opnd, *scan) == NULL)) {
 			count++;
 			scan++;
 		}
@@ -1039,6 +1068,42 @@ char *p;
 	return(count);
 }
 
+/*
+ - regvalid - is the len byte program, read from a file, well formed?
+ *
+ * Walks the nodes in order, checking that each opcode is known and that
+ * its "next" pointer and any string operand stay inside the program,
+ * so regexec() cannot be led off the end of it.
+ */
+int
+regvalid(const char *prog, size_t len)
+{
+	const char *p = prog + 1, *end = prog + len, *nul;
+	int op, next;
+
+	if (len < 1 || UCHARAT(prog) != (unsigned char)REG_MAGIC)
+		return(0);
+	while (p < end) {
+		if (end - p < 3)
+			return(0);
+		op = UCHARAT(p);	/* a plain char may be signed */
+		next = NEXT(p);
+		if (op > CLOSE+NSUBEXP-1 || (op > PLUS && op < OPEN) ||
+		    (op > OPEN+NSUBEXP-1 && op < CLOSE))
+			return(0);
+		if ((op == BACK) ? (next > p - (prog + 1)) :
+		    (next >= end - p))
+			return(0);
+		p = OPERAND(p);
+		if (op == ANYOF || op == ANYBUT || op == EXACTLY) {
+			if (NULL == (nul = memchr(p, '\0', end - p)))
+				return(0);
+			p = nul + 1;
+		}
+	}
+	return(1);
+}
+
 /*
  - regnext - dig the "next" pointer out of a node
  */
@@ -1161,6 +1226,7 @@ char *op;
 	case OPEN+7:
 	case OPEN+8:
 	case OPEN+9:
+	case OPEN+10:
 		sprintf(buf+strlen(buf), "OPEN%d", OP(op)-OPEN);
 		p = NULL;
 		break;
@@ -1173,6 +1239,7 @@ char *op;
 	case CLOSE+7:
 	case CLOSE+8:
 	case CLOSE+9:
+	case CLOSE+10:
 		sprintf(buf+strlen(buf), "CLOSE%d", OP(op)-CLOSE);
 		p = NULL;
 		break;
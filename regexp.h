@@ -4,7 +4,9 @@
  * Caveat:  this is V8 regexp(3) [actually, a reimplementation thereof],
  * not the System V one.
  */
-#define NSUBEXP  10
+#include <stddef.h>
+
+#define NSUBEXP  11
 typedef struct regexp {
 	char *startp[NSUBEXP];
 	char *endp[NSUBEXP];
@@ -12,13 +14,17 @@ typedef struct regexp {
 	char reganch;		/* Internal use only. */
 	char *regmust;		/* Internal use only. */
 	int regmlen;		/* Internal use only. */
-	char program[1];	/* Unwarranted chumminess with compiler. */
+	int regplen;		/* Internal use only. */
+	char *program;		/* Follows the struct unless loaded. */
 } regexp;
 
 extern regexp *regcomp();
 extern int regexec();
-extern void regsub();
+extern int regnexec(regexp *, const char *, size_t);
+extern int regvalid(const char *, size_t);
+extern void regsub(const regexp *, const char *, char *);
 extern void regerror();
+extern long regsteps;
 /*
  * The first byte of the regexp internal "program" is actually this magic
  * number; the start node begins in the second byte.
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * regsub - perform substitutions after a regexp match
+ *
+ * The regsub() regexp.h declares, as in Henry Spencer's package. Copies
+ * source to dest, replacing \0 with what prog matched as a whole and \1
+ * to \9 with what its parenthesized subexpressions matched; \\ is a
+ * backslash, and other backslashes are copied as they are. A group that
+ * took no part in the match gives nothing. Only prog's startp and endp
+ * are used, so a caller may renumber them. dest must have room for
+ * source with each \digit replaced by the whole match, and a NUL.
+ */
+
+#include <string.h>
+#include "regexp.h"
+
+void
+regsub(const regexp *prog, const char *source, char *dest)
+{
+	const char *src = source;
+	char *dst = dest;
+	size_t len;
+	int no;
+
+	if (NULL == prog || NULL == source || NULL == dest) {
+		regerror("NULL parm to regsub");
+		return;
+	}
+	while ('\0' != *src) {
+		if ('\\' == *src && src[1] >= '0' && src[1] <= '9')
+			no = src[1] - '0';
+		else {
+			if ('\\' == *src && '\\' == src[1])
+				src++;		/* \\ is a backslash */
+			*dst++ = *src++;
+			continue;
+		}
+		src += 2;
+		if (NULL != prog->startp[no] && NULL != prog->endp[no] &&
+		    prog->endp[no] > prog->startp[no]) {
+			len = prog->endp[no] - prog->startp[no];
+			memcpy(dst, prog->startp[no], len);
+			dst += len;
+		}
+	}
+	*dst = '\0';
+}
@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * The result cache.
+ *
+ * With --results=dir the hits each file gave are kept, for the same
+ * patterns and switches, so a search repeated over a mostly unchanged
+ * tree (say each commit of a CI run) need only lex what changed. The
+ * patterns and switches are hashed to name a file in dir holding:
+ *
+ *	struct rshdr
+ *	the key, the patterns and switches in full
+ *	struct rsfile [nfile]	sorted by path
+ *	paths
+ *	hits
+ *
+ * A file's hits are a varint line number then the NUL terminated line
+ * for each. A file is answered from its record without being read when
+ * its device, inode, size and mtime agree; otherwise it is read and its
+ * contents hashed, so a fresh checkout of the same bytes still agrees.
+ * Only when that fails too is it searched. When the results are written
+ * back, records of files that no longer exist are dropped. A damaged
+ * results file is ignored: everything is searched and it is rewritten.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cgrep.h"
+
+#define RS_MAGIC	0x0a524743	/* "CGR\n" read as a native integer */
+#define RS_VERSION	2	/* 2: -s, -c decode strings, join comments */
+
+struct rshdr {		/* start of a results file */
+	uint32_t magic;		/* RS_MAGIC, also catches byte order */
+	uint32_t version;	/* RS_VERSION */
+	uint32_t nfile;		/* files recorded */
+	uint32_t keylen;	/* bytes of key following */
+	uint64_t len;		/* bytes in the whole file */
+};
+
+struct rsfile {		/* a file's record */
+	uint64_t path;		/* offset of its path */
+	uint64_t dev;		/* as last seen */
+	uint64_t ino;
+	int64_t size;
+	int64_t sec;
+	int64_t nsec;
+	uint64_t hash;		/* of its contents */
+	uint64_t hits;		/* offset of its hits */
+	uint32_t nhit;
+	uint32_t hlen;		/* bytes of hits */
+};
+
+struct rsnew {		/* a record made this run */
+	char *path;
+	struct rsfile f;	/* offsets unset */
+	struct post hits;
+};
+
+const char *resdir;		/* --results */
+
+static char *name;		/* the results file */
+static const char *key;
+static char *img;		/* its old contents, or NULL */
+static size_t imgLen;
+static const struct rsfile *old;
+static uint32_t nold;
+static char *seen;		/* per old record: 1 still good, 2 replaced */
+
+static struct rsnew *recs;	/* records made this run */
+static size_t nrec, recsLen;
+static struct post *cur;	/* hits of the file being searched */
+static uint32_t ncur;
+
+static size_t kept, hashed, searched;	/* for --verbose */
+
+/*
+ * 64 bit FNV-1a, for file contents.
+ */
+static uint64_t
+fnv64(const void *buf, size_t n)
+{
+	const unsigned char *p = buf;
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (n--)
+		h = (h ^ *p++) * 0x100000001b3ULL;
+	return h;
+}
+
+/*
+ * The hithook: keep a hit of the file being searched.
+ */
+static void
+rshit(const char *s, int line)
+{
+	size_t n = strlen(s) + 1;
+
+	putv(cur, line);
+	ROOM(cur->p, cur->has, cur->len + n);
+	memcpy(cur->p + cur->len, s, n);
+	cur->len += n;
+	ncur++;
+}
+
+/*
+ * Print the n hits at p, as the search that found them did.
+ */
+static void
+rsprint(const unsigned char *p, uint32_t n)
+{
+	uint32_t line;
+
+	for (; n > 0; n--) {
+		line = getv(&p);
+		printhit((const char *)p, line);
+		p += strlen((const char *)p) + 1;
+	}
+}
+
+/*
+ * Whether each old record's path and hits lie within the file, its hits
+ * being nhit lines that fill hlen bytes.
+ */
+static int
+rscheck(void)
+{
+	const unsigned char *p, *q, *end;
+	uint32_t i, n;
+
+	for (i = 0; i < nold; i++) {
+		if (old[i].path >= imgLen || NULL == memchr(img + old[i].path,
+		    '\0', imgLen - old[i].path) || old[i].hits > imgLen ||
+		    old[i].hlen > imgLen - old[i].hits)
+			return 0;
+		p = (const unsigned char *)img + old[i].hits;
+		end = p + old[i].hlen;
+		for (n = old[i].nhit; n > 0; n--) {
+			if (!skipv(&p, end) ||
+			    NULL == (q = memchr(p, '\0', end - p)))
+				return 0;
+			p = q + 1;
+		}
+		if (p != end)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Open the results kept in resdir for key, the patterns and switches.
+ */
+void
+resopen(const char *k)
+{
+	const struct rshdr *h;
+	struct stat st;
+	int fd;
+
+	key = k;
+	if (-1 == mkdir(resdir, 0777) && EEXIST != errno)
+		fatal("%s: cannot make %s\n", getprogname(), resdir);
+	if (-1 == asprintf(&name, "%s/%08x%08x", resdir, fnv(k, strlen(k)),
+	    fnv(k, strlen(k) / 2)))
+		fatal(outSpace);
+
+	if ((-1 == (fd = open(name, O_RDONLY))))
+		return;
+	if (-1 != fstat(fd, &st) && (size_t)st.st_size >= sizeof(*h) &&
+	    MAP_FAILED != (img = mmap(NULL, st.st_size, PROT_READ,
+	    MAP_PRIVATE, fd, 0))) {
+		h = (const struct rshdr *)img;
+		imgLen = st.st_size;
+		if (RS_MAGIC == h->magic && RS_VERSION == h->version &&
+		    h->len == imgLen && h->keylen == strlen(k) &&
+		    !memcmp(h + 1, k, h->keylen) &&
+		    imgLen >= sizeof(*h) + ((h->keylen + 7) & ~7) +
+		    sizeof(*old) * (uint64_t)h->nfile) {
+			old = (const struct rsfile *)(img + sizeof(*h) +
+			    ((h->keylen + 7) & ~7));
+			nold = h->nfile;
+			if (rscheck())
+				seen = alloc(nold + 1);
+			else
+				nold = 0;	/* damaged: search it all */
+		}
+	}
+	else
+		img = NULL;
+	close(fd);
+}
+
+/*
+ * The old record for path, or -1.
+ */
+static long
+rsfind(const char *path)
+{
+	uint32_t lo = 0, hi = nold, mid;
+	int r;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (0 == (r = strcmp(path, img + old[mid].path)))
+			return mid;
+		if (r < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return -1;
+}
+
+/*
+ * Search filen, from its record if it is unchanged.
+ */
+void
+reslex(void)
+{
+	const struct rsfile *o = NULL;
+	struct rsnew *r;
+	struct stat st;
+	uint64_t hash = 0;
+	char *buf;
+	long i;
+	int fd;
+
+	if (-1 == stat(filen, &st) || !S_ISREG(st.st_mode)) {
+		lex();
+		return;
+	}
+	if (-1 != (i = rsfind(filen))) {
+		o = &old[i];
+		if (o->dev == (uint64_t)st.st_dev &&
+		    o->ino == (uint64_t)st.st_ino && o->size == st.st_size &&
+		    o->sec == st.st_mtim.tv_sec &&
+		    o->nsec == st.st_mtim.tv_nsec) {
+			seen[i] = 1;
+			rsprint((unsigned char *)img + o->hits, o->nhit);
+			kept++;
+			return;
+		}
+	}
+
+	/* changed, or a new checkout: compare the bytes */
+	if (-1 != (fd = open(filen, O_RDONLY))) {
+		buf = (0 == st.st_size) ? NULL : mmap(NULL, st.st_size,
+		    PROT_READ, MAP_PRIVATE, fd, 0);
+		if (MAP_FAILED != buf) {
+			hash = fnv64(buf, st.st_size);
+			if (NULL != buf)
+				munmap(buf, st.st_size);
+		}
+		close(fd);
+	}
+
+	TROOM(recs, recsLen, nrec);
+	r = &recs[nrec++];
+	memset(r, 0, sizeof(*r));
+	if (NULL == (r->path = strdup(filen)))
+		fatal(outSpace);
+	r->f.dev = st.st_dev;
+	r->f.ino = st.st_ino;
+	r->f.size = st.st_size;
+	r->f.sec = st.st_mtim.tv_sec;
+	r->f.nsec = st.st_mtim.tv_nsec;
+	r->f.hash = hash;
+	if (NULL != o)
+		seen[i] = 2;
+
+	if (NULL != o && o->hash == hash && o->size == st.st_size) {
+		r->f.nhit = o->nhit;
+		ROOM(r->hits.p, r->hits.has, o->hlen);
+		memcpy(r->hits.p, img + o->hits, o->hlen);
+		r->hits.len = o->hlen;
+		rsprint(r->hits.p, r->f.nhit);
+		hashed++;
+		return;
+	}
+
+	cur = &r->hits;
+	ncur = 0;
+	hithook = rshit;
+	if (NULL != cachedir)
+		cachelex();
+	else
+		lex();
+	hithook = NULL;
+	r->f.nhit = ncur;
+	rsprint(r->hits.p, r->f.nhit);
+	searched++;
+}
+
+static int
+reccmp(const void *a, const void *b)
+{
+	return strcmp(((const struct rsnew *)a)->path,
+	    ((const struct rsnew *)b)->path);
+}
+
+/*
+ * Write the results back if they have changed.
+ */
+void
+resclose(void)
+{
+	struct rshdr h;
+	struct rsfile f;
+	struct rsnew *r;
+	struct stat st;
+	uint64_t off;
+	uint32_t i, nfile;
+	char *tmp;
+	FILE *fp;
+	int bad;
+
+	if (verbose)
+		fprintf(stderr, "%s: results: %zu kept, %zu the same, "
+		    "%zu searched\n", getprogname(), kept, hashed, searched);
+	if (0 == nrec)
+		return;		/* nothing new */
+
+	/* old records not replaced join the new ones */
+	for (i = 0; i < nold; i++)
+		if (1 == seen[i] ||
+		    (0 == seen[i] && -1 != stat(img + old[i].path, &st))) {
+			TROOM(recs, recsLen, nrec);
+			r = &recs[nrec++];
+			memset(r, 0, sizeof(*r));
+			r->path = img + old[i].path;
+			r->f = old[i];
+			r->hits.p = (unsigned char *)img + old[i].hits;
+			r->hits.len = old[i].hlen;
+		}
+	qsort(recs, nrec, sizeof(*recs), reccmp);
+	nfile = nrec;
+
+	memset(&h, 0, sizeof(h));
+	h.magic = RS_MAGIC;
+	h.version = RS_VERSION;
+	h.nfile = nfile;
+	h.keylen = strlen(key);
+	off = sizeof(h) + ((h.keylen + 7) & ~7) + sizeof(f) * nfile;
+	for (i = 0; i < nfile; i++) {
+		recs[i].f.path = off;
+		off += strlen(recs[i].path) + 1;
+	}
+	for (i = 0; i < nfile; i++) {
+		recs[i].f.hits = off;
+		recs[i].f.hlen = recs[i].hits.len;
+		off += recs[i].hits.len;
+	}
+	h.len = off;
+
+	if (-1 == asprintf(&tmp, "%s/.%ld", resdir, (long)getpid()))
+		fatal(outSpace);
+	if (NULL == (fp = fopen(tmp, "w")))
+		fatal("%s: cannot write %s\n", getprogname(), tmp);
+	fwrite(&h, sizeof(h), 1, fp);
+	fwrite(key, 1, h.keylen, fp);
+	fwrite("\0\0\0\0\0\0\0", 1, ((h.keylen + 7) & ~7) - h.keylen, fp);
+	for (i = 0; i < nfile; i++)
+		fwrite(&recs[i].f, sizeof(f), 1, fp);
+	for (i = 0; i < nfile; i++)
+		fwrite(recs[i].path, 1, strlen(recs[i].path) + 1, fp);
+	for (i = 0; i < nfile; i++)
+		fwrite(recs[i].hits.p, 1, recs[i].hits.len, fp);
+	bad = ferror(fp);
+	if (EOF == fclose(fp) || bad || -1 == rename(tmp, name)) {
+		unlink(tmp);
+		fatal("%s: cannot write %s\n", getprogname(), name);
+	}
+	free(tmp);
+}
@@ -0,0 +1,477 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * The query daemon.
+ *
+ * "cgrep --serve=sock path ..." reads every source named into memory and
+ * lexes it once, interning each distinct identifier and chain; a file
+ * keeps just the (slice number, line) pairs of its occurrences. Each
+ * query made with --connect is answered by a child forked from the
+ * daemon, which so starts with everything warm. The client passes its
+ * arguments, its standard output and error and its working directory
+ * over the socket; the child moves there, so that -f and --patterns
+ * files are found as the client would find them, runs cgrep() on the
+ * arguments as usual, writing straight to the client, and ends by
+ * sending back the exit status, 1 if it fails on the way.
+ *
+ * A query tries the pattern once per distinct slice, not once per
+ * occurrence, and reads nothing from disk. Before forking, the daemon
+ * rereads any file whose mtime or size has changed.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cgrep.h"
+
+struct sfile {		/* a file held by the daemon */
+	char *path;
+	char *buf;		/* its contents */
+	size_t len;
+	off_t size;		/* when read, -1 if gone */
+	struct timespec mtim;
+	uint32_t *occ;		/* slice number, line pairs */
+	size_t nocc, occLen;
+};
+
+struct slice {		/* an interned slice */
+	size_t off;		/* of its text in arena */
+	uint32_t len;
+	uint32_t hash;
+};
+
+struct request {	/* what --connect sends before the arguments */
+	uint32_t argc;
+	uint32_t len;		/* bytes of NUL terminated arguments */
+};
+
+static struct sfile *sfiles;
+static size_t nsfile, sfilesLen;
+static struct sfile *cur;	/* file being lexed */
+
+static struct slice *slices;	/* interned slices by number */
+static uint32_t nslice;
+static size_t slicesLen;
+static uint32_t *stab;		/* slice number + 1 by hash, 0 is empty */
+static uint32_t smask;
+static char *arena;		/* slice texts */
+static size_t arenaUsed, arenaHas;
+
+static int answerfd = -1;	/* connection a child is answering */
+
+/*
+ * The number of slice p, n, interning it if new.
+ */
+static uint32_t
+intern(const char *p, size_t n)
+{
+	struct slice *sl;
+	uint32_t h, slot, i, *nt;
+
+	h = fnv(p, n);
+	for (slot = h & smask; 0 != stab[slot]; slot = (slot + 1) & smask) {
+		sl = &slices[stab[slot] - 1];
+		if (sl->hash == h && sl->len == n &&
+		    !memcmp(arena + sl->off, p, n))
+			return stab[slot] - 1;
+	}
+
+	ROOM(arena, arenaHas, arenaUsed + n);
+	memcpy(arena + arenaUsed, p, n);
+	TROOM(slices, slicesLen, nslice);
+	sl = &slices[nslice];
+	sl->off = arenaUsed;
+	sl->len = n;
+	sl->hash = h;
+	arenaUsed += n;
+	stab[slot] = ++nslice;
+
+	if (nslice > smask / 2) {	/* grow the table */
+		nt = alloc(sizeof(*nt) * 2 * (smask + 1));
+		for (i = 0; i < nslice; i++) {
+			for (slot = slices[i].hash & (2 * smask + 1);
+			    0 != nt[slot]; slot = (slot + 1) & (2 * smask + 1))
+				;
+			nt[slot] = i + 1;
+		}
+		free(stab);
+		stab = nt;
+		smask = 2 * smask + 1;
+	}
+	return nslice - 1;
+}
+
+/*
+ * The slicehook while loading: note an occurrence.
+ */
+static void
+srvslice(const char *p, size_t n, int line)
+{
+	TROOM(cur->occ, cur->occLen, cur->nocc + 1);
+	cur->occ[cur->nocc++] = intern(p, n);
+	cur->occ[cur->nocc++] = line;
+}
+
+/*
+ * Read sf into memory and lex it.
+ */
+static void
+load(struct sfile *sf)
+{
+	struct stat st;
+	ssize_t n;
+	int fd;
+
+	free(sf->buf);
+	sf->buf = NULL;
+	sf->len = sf->nocc = 0;
+	sf->size = -1;
+	if ((-1 == (fd = open(sf->path, O_RDONLY))) ||
+	    (-1 == fstat(fd, &st))) {
+		if (-1 != fd)
+			close(fd);
+		return;
+	}
+	sf->buf = alloc(st.st_size + 1);
+	while (sf->len < (size_t)st.st_size &&
+	    0 < (n = read(fd, sf->buf + sf->len, st.st_size - sf->len)))
+		sf->len += n;
+	close(fd);
+	sf->size = st.st_size;
+	sf->mtim = st.st_mtim;
+
+	cur = sf;
+	filen = sf->path;
+	slicehook = srvslice;
+	setinput(sf->buf, sf->len);
+	lex();
+	slicehook = NULL;
+}
+
+/*
+ * Reread the files that have changed since they were loaded.
+ */
+static void
+refresh(void)
+{
+	struct stat st;
+	size_t i, n = 0;
+
+	for (i = 0; i < nsfile; i++) {
+		if (-1 == stat(sfiles[i].path, &st)) {
+			if (-1 != sfiles[i].size) {	/* gone */
+				free(sfiles[i].buf);
+				sfiles[i].buf = NULL;
+				sfiles[i].len = sfiles[i].nocc = 0;
+				sfiles[i].size = -1;
+				n++;
+			}
+			continue;
+		}
+		if (st.st_size != sfiles[i].size ||
+		    st.st_mtim.tv_sec != sfiles[i].mtim.tv_sec ||
+		    st.st_mtim.tv_nsec != sfiles[i].mtim.tv_nsec) {
+			load(&sfiles[i]);
+			n++;
+		}
+	}
+	if (verbose && n)
+		fprintf(stderr, "%s: reread %zu files\n", getprogname(), n);
+}
+
+/*
+ * At exit(3) from a child, as through usage() or fatal(): tell the
+ * client the query failed.
+ */
+static void
+failed(void)
+{
+	unsigned char status = 1;
+
+	oflush();
+	write(answerfd, &status, 1);
+}
+
+/*
+ * Answer the query on connection fd, in a child of the daemon.
+ */
+__dead static void
+answer(int fd)
+{
+	struct request rq;
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct iovec iov;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} cmsg;
+	char **argv, *args, *p;
+	size_t got;
+	ssize_t n;
+	uint32_t i;
+	int fds[3];		/* stdout, stderr, working directory */
+	unsigned char status;
+
+	answerfd = fd;
+	atexit(failed);
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &rq;
+	iov.iov_len = sizeof(rq);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsg.buf;
+	msg.msg_controllen = sizeof(cmsg.buf);
+	if ((sizeof(rq) != recvmsg(fd, &msg, 0)) ||
+	    (NULL == (cm = CMSG_FIRSTHDR(&msg))) ||
+	    (SCM_RIGHTS != cm->cmsg_type) ||
+	    (CMSG_LEN(sizeof(fds)) != cm->cmsg_len) ||
+	    (0 == rq.argc))
+		exit(1);
+	memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+
+	args = alloc(rq.len + 1);
+	for (got = 0; got < rq.len; got += n)
+		if (0 >= (n = read(fd, args + got, rq.len - got)))
+			exit(1);
+	argv = alloc(sizeof(char *) * (rq.argc + 1));
+	for (i = 0, p = args; i < rq.argc && p < args + rq.len; i++) {
+		argv[i] = p;
+		p += strlen(p) + 1;
+	}
+	if (i != rq.argc)
+		exit(1);
+
+	dup2(fds[0], STDOUT_FILENO);
+	dup2(fds[1], STDERR_FILENO);
+	close(fds[0]);
+	close(fds[1]);
+	if (-1 == fchdir(fds[2]))	/* the files are held, not reopened */
+		fatal("%s: cannot use the client's directory\n",
+		    getprogname());
+	close(fds[2]);
+
+	served = 1;
+	verbose = 0;		/* the query's own switches */
+	status = cgrep(rq.argc, argv);
+	oflush();
+	write(fd, &status, 1);
+	_exit(0);		/* not again through failed() */
+}
+
+/*
+ * Hold the sources under paths in memory and answer queries on sock.
+ */
+__dead void
+serve(const char *sock, int npath, char **paths)
+{
+	struct sockaddr_un sun;
+	struct sfile *sf;
+	size_t i;
+	int s, fd;
+
+	smask = 1023;
+	stab = alloc(sizeof(*stab) * (smask + 1));
+	for (; npath > 0; npath--, paths++) {
+		walk(*paths);
+		for (i = 0; i < nfiles; i++) {
+			TROOM(sfiles, sfilesLen, nsfile);
+			sf = &sfiles[nsfile++];
+			memset(sf, 0, sizeof(*sf));
+			if (NULL == (sf->path = strdup(files[i].path)))
+				fatal(outSpace);
+			load(sf);
+		}
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(sock) >= sizeof(sun.sun_path))
+		fatal("%s: socket name too long\n", getprogname());
+	strcpy(sun.sun_path, sock);
+	unlink(sock);
+	if ((-1 == (s = socket(AF_UNIX, SOCK_STREAM, 0))) ||
+	    (-1 == bind(s, (struct sockaddr *)&sun, sizeof(sun))) ||
+	    (-1 == listen(s, 16)))
+		fatal("%s: cannot listen on %s\n", getprogname(), sock);
+	signal(SIGCHLD, SIG_IGN);	/* no zombies */
+	if (verbose)
+		fprintf(stderr, "%s: holding %zu files, %u slices\n",
+		    getprogname(), nsfile, nslice);
+
+	for (;;) {
+		if (-1 == (fd = accept(s, NULL, NULL))) {
+			if (EINTR == errno || ECONNABORTED == errno)
+				continue;
+			fatal("%s: accept failed\n", getprogname());
+		}
+		refresh();
+		switch (fork()) {
+		case -1:
+			fprintf(stderr, "%s: cannot fork\n", getprogname());
+			break;
+		case 0:
+			close(s);
+			answer(fd);
+		}
+		close(fd);
+	}
+}
+
+/*
+ * Have the daemon on sock run cgrep with our arguments, returning its
+ * exit status.
+ */
+int
+client(const char *sock, int argc, char **argv)
+{
+	struct sockaddr_un sun;
+	struct request rq;
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct iovec iov;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} cmsg;
+	int fds[3] = { STDOUT_FILENO, STDERR_FILENO, -1 };
+	unsigned char status;
+	ssize_t n;
+	int s, i;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(sock) >= sizeof(sun.sun_path))
+		fatal("%s: socket name too long\n", getprogname());
+	strcpy(sun.sun_path, sock);
+	if ((-1 == (s = socket(AF_UNIX, SOCK_STREAM, 0))) ||
+	    (-1 == connect(s, (struct sockaddr *)&sun, sizeof(sun))))
+		fatal("%s: cannot connect to %s\n", getprogname(), sock);
+	if (-1 == (fds[2] = open(".", O_RDONLY)))
+		fatal("%s: cannot open the current directory\n",
+		    getprogname());
+
+	rq.argc = argc;
+	for (rq.len = 0, i = 0; i < argc; i++)
+		rq.len += strlen(argv[i]) + 1;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&cmsg, 0, sizeof(cmsg));
+	iov.iov_base = &rq;
+	iov.iov_len = sizeof(rq);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsg.buf;
+	msg.msg_controllen = sizeof(cmsg.buf);
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+	if (sizeof(rq) != sendmsg(s, &msg, 0))
+		fatal("%s: cannot send to %s\n", getprogname(), sock);
+	close(fds[2]);
+	for (i = 0; i < argc; i++) {
+		const char *p = argv[i];
+		size_t left = strlen(p) + 1;
+
+		for (; left > 0; p += n, left -= n)
+			if (0 >= (n = write(s, p, left)))
+				fatal("%s: cannot send to %s\n",
+				    getprogname(), sock);
+	}
+
+	if (1 != read(s, &status, 1))	/* daemon child died */
+		return 1;
+	close(s);
+	return status;
+}
+
+/*
+ * Run the query over the files held, in a child of the daemon. Strings
+ * and comments (text set) need the files lexed again, though from
+ * memory; otherwise each distinct slice is tried at most once.
+ */
+void
+srvsearch(int text)
+{
+	unsigned char *known;	/* per slice: 0 not tried, 1 miss, 2 hit */
+	uint32_t *lines = NULL, id;
+	size_t linesLen = 0, nl, i, k, tried = 0;
+	struct sfile *sf;
+
+	known = alloc(nslice + 1);
+	for (i = 0; i < nsfile; i++) {
+		sf = &sfiles[i];
+		if (-1 == sf->size)
+			continue;
+		filen = sf->path;
+		if (text) {
+			setinput(sf->buf, sf->len);
+			lex();
+			continue;
+		}
+
+		for (k = nl = 0; k < sf->nocc; k += 2) {
+			id = sf->occ[k];
+			if (0 == known[id]) {
+				known[id] = 1 + match(arena + slices[id].off,
+				    slices[id].len);
+				tried++;
+			}
+			if (2 == known[id] &&
+			    (0 == nl || lines[nl - 1] != sf->occ[k + 1])) {
+				TROOM(lines, linesLen, nl);
+				lines[nl++] = sf->occ[k + 1];
+			}
+		}
+		if (nl) {
+			setinput(sf->buf, sf->len);
+			printlines(lines, nl);
+		}
+	}
+	if (verbose)
+		fprintf(stderr, "%s: %zu files, %zu of %u slices tried\n",
+		    getprogname(), nsfile, tried, nslice);
+	free(known);
+	free(lines);
+}
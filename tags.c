@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Tags.
+ *
+ * With --tags=file the lexer also feeds each identifier and each
+ * punctuation character outside strings and comments to a small
+ * recogniser of definitions, and file is written as a sorted ctags(1)
+ * tags file. The recogniser goes by layout rather than by parsing C:
+ *
+ *	#define NAME
+ *	struct, union or enum NAME {		at any depth
+ *	typedef ... NAME ;			at depth 0, or typedef ... (*NAME)
+ *	NAME ( ... ) {				at depth 0, or with old style
+ *						parameter declarations between
+ *
+ * Preprocessor lines, with their continuations, and C++ // comments do
+ * not count towards brace or parenthesis depth.
+ *
+ * Directories named are walked for sources. The files are split by size
+ * among --jobs workers, by default one per processor, forked so each
+ * can lex as usual. Each leaves its output and its tags in temporary
+ * files, which are put together in order.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cgrep.h"
+
+struct tagat {		/* a definition found in the current file */
+	const char *name;	/* in the input */
+	size_t len;
+	int line;
+};
+
+const char *tagfile;		/* --tags */
+int tagjobs;			/* --jobs, 0 for one per processor */
+
+static struct tagat *found;	/* in the current file */
+static size_t nfound, foundLen;
+
+static char *tags;		/* tag lines, NUL terminated */
+static size_t tagsUsed, tagsHas;
+static size_t *tagoff;		/* where each starts in tags */
+static size_t ntag, tagoffLen;
+
+/* the recogniser */
+static int lastline;		/* of the last token */
+static int depth, paren;	/* brace and parenthesis depth */
+static int ppline;		/* preprocessor line being skipped */
+static char ppcont;		/* that line ended with a backslash */
+static char dfn;		/* 1 after #, 2 after #define */
+static char agg;		/* 1 after struct/union/enum, 2 after a name */
+static struct tagat aggname;
+static char tdef;		/* in a typedef */
+static struct tagat tdname;	/* last name in it, at depth 0 */
+static struct tagat tdfptr;	/* or the (*NAME) in it */
+static char fn;			/* 1 in NAME(, 2 after ), 3 in old params */
+static struct tagat fnname;
+static char prevword;		/* last token was a word */
+static char prevstar;		/* or a * */
+static struct tagat word;	/* last word */
+static const char *slash;	/* a / held back, or NULL */
+static int slashline;
+static int cmtline;		/* line of a // comment */
+
+static void
+tag(const struct tagat *t)
+{
+	TROOM(found, foundLen, nfound);
+	found[nfound++] = *t;
+}
+
+static int
+is(const char *w, size_t n, const char *kw)
+{
+	return n == strlen(kw) && !memcmp(w, kw, n);
+}
+
+/*
+ * Turn the definitions found in the input buf, n into tag lines.
+ */
+static void
+tagflush(const char *buf, size_t n)
+{
+	const char *s, *e, *end = buf + n;
+	size_t i, need;
+
+	for (i = 0; i < nfound; i++) {
+		for (s = found[i].name; s > buf && '\n' != s[-1]; s--)
+			;
+		if (NULL == (e = memchr(found[i].name, '\n',
+		    end - found[i].name)))
+			e = end;
+		if (e > s && '\r' == e[-1])
+			e--;
+
+		/* name, file and a search pattern, with / and \ escaped */
+		need = found[i].len + strlen(filen) + 2 * (e - s) + 10;
+		ROOM(tags, tagsHas, tagsUsed + need);
+		TROOM(tagoff, tagoffLen, ntag);
+		tagoff[ntag++] = tagsUsed;
+		tagsUsed += sprintf(tags + tagsUsed, "%.*s\t%s\t/^",
+		    (int)found[i].len, found[i].name, filen);
+		for (; s < e; s++) {
+			if ('/' == *s || '\\' == *s)
+				tags[tagsUsed++] = '\\';
+			tags[tagsUsed++] = *s;
+		}
+		tagsUsed += sprintf(tags + tagsUsed, "$/\n") + 1;
+	}
+	nfound = 0;
+}
+
+/*
+ * Take a token: c is a punctuation character, 0 for the word w, n, or
+ * EOF with the whole input in w, n.
+ */
+static void
+tagone(int c, const char *w, size_t n, int line)
+{
+	int bol = line != lastline;
+
+	lastline = line;
+	if (EOF == c) {
+		tagflush(w, n);
+		depth = paren = ppline = ppcont = dfn = agg = tdef = fn = 0;
+		prevword = prevstar = lastline = 0;
+		return;
+	}
+
+	/* preprocessor lines */
+	if (ppcont && line == ppline + 1)
+		ppline = line;
+	ppcont = 0;
+	if ('#' == c && bol) {
+		ppline = line;
+		dfn = 1;
+		return;
+	}
+	if (0 != ppline && line == ppline) {
+		if ('\\' == c)
+			ppcont = 1;
+		else if (1 == dfn && 0 == c && is(w, n, "define"))
+			dfn = 2;
+		else if (2 == dfn && 0 == c) {
+			word.name = w;
+			word.len = n;
+			word.line = line;
+			tag(&word);
+			dfn = 0;
+		}
+		else
+			dfn = 0;
+		return;
+	}
+	dfn = 0;
+
+	if (0 == c) {
+		word.name = w;
+		word.len = n;
+		word.line = line;
+		if (is(w, n, "struct") || is(w, n, "union") ||
+		    is(w, n, "enum")) {
+			agg = 1;
+			if (3 == fn)	/* a declaration after all */
+				fn = 0;
+		}
+		else if (1 == agg) {
+			aggname = word;
+			agg = 2;
+		}
+		else
+			agg = 0;
+		if (0 == depth && 0 == paren && is(w, n, "typedef")) {
+			tdef = 1;
+			tdname.name = tdfptr.name = NULL;
+			fn = 0;
+		}
+		else if (tdef && 0 == depth && 0 == paren)
+			tdname = word;
+		else if (tdef && 0 == depth && prevstar && NULL == tdfptr.name)
+			tdfptr = word;
+		if (2 == fn)
+			fn = 3;
+		prevword = 1;
+		prevstar = 0;
+		return;
+	}
+
+	switch (c) {
+	case '{':
+		if (2 == agg)
+			tag(&aggname);
+		if (0 == depth && (2 == fn || 3 == fn))
+			tag(&fnname);
+		agg = fn = 0;
+		depth++;
+		break;
+	case '}':
+		if (depth > 0)
+			depth--;
+		agg = 0;
+		break;
+	case '(':
+		if (0 == depth && 0 == paren && prevword && !tdef && 1 != fn) {
+			fnname = word;
+			fn = 1;
+		}
+		else if (3 == fn)
+			fn = 0;
+		paren++;
+		agg = 0;
+		break;
+	case ')':
+		if (paren > 0)
+			paren--;
+		if (1 == fn && 0 == paren)
+			fn = 2;
+		agg = 0;
+		break;
+	case ';':
+	case ',':
+		if (tdef && 0 == depth && 0 == paren) {
+			if (NULL != tdfptr.name)
+				tag(&tdfptr);
+			else if (NULL != tdname.name)
+				tag(&tdname);
+			tdname.name = tdfptr.name = NULL;
+			if (';' == c)
+				tdef = 0;
+		}
+		if (2 == fn || (3 == fn && ',' == c))
+			fn = 0;
+		agg = 0;
+		break;
+	case '=':
+		if (2 == fn || 3 == fn)
+			fn = 0;
+		agg = 0;
+		break;
+	default:
+		if (2 == fn)	/* not a definition */
+			fn = 0;
+		agg = 0;
+	}
+	prevword = 0;
+	prevstar = '*' == c;
+}
+
+/*
+ * The tokhook. lex() knows only C comments, so a / is held until the
+ * next token shows whether it starts a // comment, whose tokens are
+ * then passed over to the end of the line.
+ */
+static void
+tagtok(int c, const char *w, size_t n, int line)
+{
+	if (EOF != c && line == cmtline)
+		return;
+	if (NULL != slash) {
+		if ('/' == c && w == slash + 1) {
+			slash = NULL;
+			cmtline = line;
+			return;
+		}
+		tagone('/', slash, 1, slashline);
+		slash = NULL;
+	}
+	if ('/' == c) {
+		slash = w;
+		slashline = line;
+		return;
+	}
+	if (EOF == c)
+		cmtline = 0;
+	tagone(c, w, n, line);
+}
+
+/*
+ * The slicehook when only tags are wanted.
+ */
+static void
+noslice(const char *p, size_t n, int line)
+{
+	(void)p;
+	(void)n;
+	(void)line;
+}
+
+static int
+tagcmp(const void *a, const void *b)
+{
+	return strcmp(tags + *(const size_t *)a, tags + *(const size_t *)b);
+}
+
+/*
+ * Copy what a worker left in fp to our output, or keep it as tags.
+ */
+static void
+collect(FILE *fp, int astags)
+{
+	char buf[BUFSIZ];
+	char *p = NULL;
+	size_t has = 0, n;
+	ssize_t len;
+
+	rewind(fp);
+	if (!astags) {
+		while (0 < (n = fread(buf, 1, sizeof(buf), fp)))
+			owrite(buf, n);
+	}
+	else
+		while (-1 != (len = getline(&p, &has, fp))) {
+			ROOM(tags, tagsHas, tagsUsed + len + 1);
+			TROOM(tagoff, tagoffLen, ntag);
+			tagoff[ntag++] = tagsUsed;
+			memcpy(tags + tagsUsed, p, len + 1);
+			tagsUsed += len + 1;
+		}
+	free(p);
+	fclose(fp);
+}
+
+/*
+ * Lex the npath files, and the sources under those that are directories,
+ * searching if search is set, and write tagfile.
+ */
+void
+tagrun(int npath, char **paths, int search)
+{
+	struct stat st;
+	FILE **outs, **tfps, *fp;
+	off_t *sizes, total = 0, sofar = 0;
+	pid_t *pids;
+	int jobs, j, i, n, first, status;
+	char **names = NULL;
+	size_t k, namesLen = 0;
+
+	for (n = 0; npath > 0; npath--, paths++) {
+		if (-1 == stat(*paths, &st) || !S_ISDIR(st.st_mode)) {
+			TROOM(names, namesLen, (size_t)n);
+			names[n++] = *paths;
+			continue;
+		}
+		walk(*paths);
+		for (k = 0; k < nfiles; k++) {
+			TROOM(names, namesLen, (size_t)n);
+			if (NULL == (names[n++] = strdup(files[k].path)))
+				fatal(outSpace);
+		}
+	}
+	paths = names;
+
+	tokhook = tagtok;
+	if (!search)
+		slicehook = noslice;
+	if ((jobs = tagjobs) <= 0 &&
+	    (jobs = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+		jobs = 1;
+	if (jobs > n)
+		jobs = n;
+	if (0 == n)
+		jobs = 1;
+
+	if (jobs <= 1) {
+		for (i = 0; i < n; i++) {
+			filen = paths[i];
+			lex();
+		}
+	}
+	else {
+		/* contiguous runs of files, about the same size each */
+		sizes = alloc(sizeof(*sizes) * n);
+		for (i = 0; i < n; i++)
+			if (-1 != stat(paths[i], &st))
+				total += sizes[i] = st.st_size;
+		outs = alloc(sizeof(*outs) * jobs);
+		tfps = alloc(sizeof(*tfps) * jobs);
+		pids = alloc(sizeof(*pids) * jobs);
+		oflush();		/* or each worker would write it */
+		for (j = 0, i = 0; j < jobs; j++) {
+			/* at least one file each, the rest to the last */
+			for (first = i; i < n - (jobs - j - 1) && (i == first ||
+			    sofar < total / jobs * (j + 1)); i++)
+				sofar += sizes[i];
+			if (j + 1 == jobs)
+				i = n;
+			if ((NULL == (outs[j] = tmpfile())) ||
+			    (NULL == (tfps[j] = tmpfile())))
+				fatal("%s: cannot make temporary file\n",
+				    getprogname());
+			switch (pids[j] = fork()) {
+			case -1:
+				fatal("%s: cannot fork\n", getprogname());
+			case 0:
+				if (-1 == dup2(fileno(outs[j]), STDOUT_FILENO))
+					_exit(1);
+				for (; first < i; first++) {
+					filen = paths[first];
+					lex();
+				}
+				oflush();
+				for (k = 0; k < ntag; k++)
+					fputs(tags + tagoff[k], tfps[j]);
+				_exit(EOF == fflush(tfps[j]));
+			}
+		}
+		for (j = 0; j < jobs; j++) {
+			if (-1 == waitpid(pids[j], &status, 0) ||
+			    !WIFEXITED(status) || 0 != WEXITSTATUS(status))
+				fatal("%s: a worker failed\n", getprogname());
+			collect(outs[j], 0);
+			collect(tfps[j], 1);
+		}
+		free(sizes);
+		free(outs);
+		free(tfps);
+		free(pids);
+	}
+	tokhook = NULL;
+
+	qsort(tagoff, ntag, sizeof(*tagoff), tagcmp);
+	if (NULL == (fp = fopen(tagfile, "w")))
+		fatal("%s: cannot write %s\n", getprogname(), tagfile);
+	for (k = 0; k < ntag; k++)
+		fputs(tags + tagoff[k], fp);
+	if (EOF == fclose(fp))
+		fatal("%s: cannot write %s\n", getprogname(), tagfile);
+	if (verbose)
+		fprintf(stderr, "%s: %zu tags from %d files, %d jobs\n",
+		    getprogname(), ntag, n, jobs);
+}
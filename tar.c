@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Searching inside tar archives.
+ *
+ * A .tar, .tar.gz or .tgz named on the command line is read as a
+ * stream, a member at a time, and each source member is handed to the
+ * lexer from memory, named archive:member. Nothing is extracted, and
+ * only one member is held at a time, so memory is bounded by the
+ * largest member rather than the archive. Members are chosen as walk()
+ * chooses files, honouring --include and --exclude.
+ *
+ * Reads ustar archives with GNU long names and pax path records.
+ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "cgrep.h"
+
+#define TBLOCK	512
+
+/*
+ * Is name an archive cgrep reads?
+ */
+int
+tarname(const char *name)
+{
+	static const char *const suffix[] = { ".tar", ".tar.gz", ".tgz",
+	    NULL };
+	const char *const *s;
+	size_t n = strlen(name);
+
+	for (s = suffix; NULL != *s; s++)
+		if (n > strlen(*s) && !strcmp(name + n - strlen(*s), *s))
+			return 1;
+	return 0;
+}
+
+/*
+ * A header's number field, octal or (for big members) base 256.
+ */
+static uint64_t
+tarnum(const unsigned char *p, size_t n)
+{
+	uint64_t v = 0;
+
+	if (*p & 0x80) {
+		for (v = *p++ & 0x3f; --n > 0; p++)
+			v = v << 8 | *p;
+		return v;
+	}
+	for (; n > 0 && ' ' == *p; p++, n--)
+		;
+	for (; n > 0 && *p >= '0' && *p <= '7'; p++, n--)
+		v = v << 3 | (*p - '0');
+	return v;
+}
+
+/*
+ * Is the header block h whole? Its checksum counts the checksum field
+ * as spaces.
+ */
+static int
+tarsum(const unsigned char *h)
+{
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < TBLOCK; i++)
+		sum += (i >= 148 && i < 156) ? ' ' : h[i];
+	return sum == tarnum(h + 148, 8);
+}
+
+/*
+ * Read n bytes of gz into buf, or skip them if buf is NULL. Returns -1
+ * if the archive ends first.
+ */
+static int
+tarread(gzFile gz, char *buf, uint64_t n)
+{
+	char skip[8192];
+	int k, r;
+
+	while (n > 0) {
+		k = (n > sizeof(skip)) ? sizeof(skip) : n;
+		if ((r = gzread(gz, (NULL != buf) ? buf : skip, k)) <= 0)
+			return -1;
+		if (NULL != buf)
+			buf += r;
+		n -= r;
+	}
+	return 0;
+}
+
+/*
+ * Make *bufp hold n bytes, in one step: members can be big.
+ */
+static void
+grow(char **bufp, size_t *hasp, uint64_t n)
+{
+	if (n > *hasp) {
+		if (NULL == (*bufp = realloc(*bufp, n)))
+			fatal(outSpace);
+		*hasp = n;
+	}
+}
+
+/*
+ * Search the members of archive filen.
+ */
+void
+tarlex(void)
+{
+	unsigned char h[TBLOCK];
+	char *archive = filen, *buf = NULL, *name = NULL, *longname = NULL;
+	char *p, *q, *end;
+	size_t bufLen = 0, nameLen = 0;
+	uint64_t size, pad;
+	gzFile gz;
+	int n;
+
+	if (NULL == (gz = gzopen(archive, "rb"))) {
+		fprintf(stderr, "cgrep: warning cannot open %s\n", archive);
+		return;
+	}
+	while (TBLOCK == (n = gzread(gz, h, TBLOCK))) {
+		if ('\0' == h[0])	/* end of archive */
+			goto done;
+		if (!tarsum(h)) {
+			fprintf(stderr, "cgrep: warning %s is not a tar "
+			    "archive\n", archive);
+			goto done;
+		}
+		size = tarnum(h + 124, 12);
+		pad = (TBLOCK - size % TBLOCK) % TBLOCK;
+
+		switch (h[156]) {
+		case 'L':		/* GNU long name of the next member */
+		case 'x':		/* pax records for the next member */
+			grow(&buf, &bufLen, size + 1);
+			if (-1 == tarread(gz, buf, size) ||
+			    -1 == tarread(gz, NULL, pad))
+				goto trunc;
+			buf[size] = '\0';
+			free(longname);
+			longname = NULL;
+			if ('L' == h[156])
+				longname = strdup(buf);
+			/* "len key=value\n" records */
+			else for (p = buf, end = buf + size; p < end; p = q) {
+				q = p + strtoul(p, NULL, 10);
+				if (q <= p || q > end)
+					break;
+				p += strcspn(p, " ") + 1;
+				if (!strncmp(p, "path=", 5)) {
+					free(longname);
+					longname = strndup(p + 5, q - 1 - p - 5);
+				}
+			}
+			continue;
+		case '0':
+		case '\0':
+		case '7':
+			break;
+		default:		/* directories, links, devices */
+			if (-1 == tarread(gz, NULL, size + pad))
+				goto trunc;
+			free(longname);
+			longname = NULL;
+			continue;
+		}
+
+		/* the member's name, from before or prefix/name */
+		ROOM(name, nameLen, strlen(archive) + 100 + 155 + 3 +
+		    (NULL != longname ? strlen(longname) : 0));
+		p = name + sprintf(name, "%s:", archive);
+		if (NULL != longname)
+			strcpy(p, longname);
+		else if ('\0' != h[345] && !memcmp(h + 257, "ustar", 5))
+			sprintf(p, "%.155s/%.100s", h + 345, h);
+		else
+			sprintf(p, "%.100s", h);
+		free(longname);
+		longname = NULL;
+
+		if (!csource(p)) {
+			if (-1 == tarread(gz, NULL, size + pad))
+				goto trunc;
+			continue;
+		}
+		grow(&buf, &bufLen, size + 1);
+		if (-1 == tarread(gz, buf, size) ||
+		    -1 == tarread(gz, NULL, pad))
+			goto trunc;
+		buf[size] = '\0';
+		filen = name;
+		setinput(buf, size);
+		lex();
+		filen = archive;
+	}
+	if (0 == n)		/* ends between members */
+		goto done;
+trunc:
+	fprintf(stderr, "cgrep: warning %s is cut short\n", archive);
+done:
+	gzclose(gz);
+	free(buf);
+	free(name);
+	free(longname);
+}
@@ -0,0 +1,22 @@
+#include <string.h>
+
+struct buf {
+	char *data;
+	size_t len;
+};
+
+/* get_len gives the length */
+static size_t
+get_len(struct buf *b)
+{
+	return b->len;
+}
+
+void
+copy(struct buf *b, const char *s)
+{
+	lock_acquire();
+	memcpy(b->data, s,
+	    sizeof(*b->data) * strlen(s));
+	b->len = strlen(s);
+}
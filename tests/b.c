@@ -0,0 +1,10 @@
+int recieve_msg;
+int recv_msg(void);
+
+void
+post(const char *s)
+{
+	lock_acquire();
+	printf("lock %s\n", s);
+	lock_release();
+}
@@ -0,0 +1,397 @@
+#!/bin/sh
+#	$NetBSD$
+#
+# Regression tests for cgrep's options: each is run over the fixtures
+# a.c and b.c, or files made from them, and its output and exit status
+# compared with those written here.
+#
+#	sh regress.sh [cgrep]
+#
+# cgrep is by default the one built beside these sources. The tests that
+# fail are printed, and the exit status is the number of them.
+
+fix=$(cd "$(dirname "$0")" && pwd)
+prog=${1:-$fix/../cgrep}
+case $prog in
+/*)	;;
+*)	prog=$(pwd)/$prog ;;
+esac
+if [ ! -x "$prog" ]; then
+	echo "regress.sh: no cgrep at $prog" >&2
+	exit 1
+fi
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+mkdir "$tmp/bin"
+ln -s "$prog" "$tmp/bin/cgrep"	# so messages are headed cgrep
+PATH=$tmp/bin:$PATH
+cd "$tmp" || exit 1
+cp "$fix/a.c" "$fix/b.c" .
+
+nfail=0
+ntest=0
+
+# Run cgrep with the arguments given, leaving its output, then its exit
+# status, in got.
+t()
+{
+	got=$(cgrep "$@" </dev/null 2>&1; echo "exit $?")
+}
+
+# Likewise but with what it says on stderr, as --verbose, in err.
+tv()
+{
+	got=$(cgrep "$@" </dev/null 2>"$tmp/err"; echo "exit $?")
+	err=$(cat "$tmp/err")
+}
+
+# Compare got with what the test called $1 should give, $2.
+check()
+{
+	ntest=$((ntest + 1))
+	[ "$got" = "$2" ] && return
+	nfail=$((nfail + 1))
+	printf 'FAIL %s\nwant:\n%s\ngot:\n%s\n' "$1" "$2" "$got"
+}
+
+# Overwrite the last n bytes of a file with 0xff.
+damage()
+{
+	size=$(wc -c <"$1")
+	head -c "$2" /dev/zero | tr '\0' '\377' |
+	    dd of="$1" bs=1 seek=$((size - $2)) conv=notrunc 2>/dev/null
+}
+
+# --query
+t --query='lock_acquire AND NOT lock_release' a.c b.c
+check query-not "a.c
+exit 0"
+t --query='lock_acquire NEAR/1 printf' a.c b.c
+check query-near "b.c
+exit 0"
+t --query='(get_len OR post) AND strlen' a.c b.c
+check query-paren "a.c
+exit 0"
+t --query='lock_acquire AND' a.c
+check query-bad "cgrep: --query: pattern expected
+exit 1"
+
+# --tokens
+t -n --tokens='memcpy ( ... sizeof' a.c b.c
+check tokens-gap "a.c:   20: 	    sizeof(*b->data) * strlen(s));
+exit 0"
+t -n --tokens='memcpy ( ...1 sizeof' a.c b.c
+check tokens-short "exit 0"
+t -n --tokens='b -> len =' a.c
+check tokens-punct "a.c:   21: 	b->len = strlen(s);
+exit 0"
+t --tokens='memcpy ...' a.c
+check tokens-trailing "cgrep: --tokens: nothing after ...
+exit 1"
+
+# --fuzzy
+t -n --fuzzy=2 receive_msg a.c b.c
+check fuzzy "b.c:    1: int recieve_msg;
+exit 0"
+t -n --fuzzy=3 receive_msg a.c b.c
+check fuzzy-3 "b.c:    1: int recieve_msg;
+b.c:    2: int recv_msg(void);
+exit 0"
+t --fuzzy=64 receive_msg a.c
+check fuzzy-range "cgrep: --fuzzy distance must be 0 to 63
+exit 1"
+t --fuzzy=2x receive_msg a.c
+check fuzzy-number "cgrep: bad --fuzzy distance 2x
+exit 1"
+
+# -s and -c
+t -n -s -e 'lock %s' a.c b.c
+check strings 'b.c:    8: lock %s\n
+exit 0'
+t -l -c -e length a.c b.c
+check comments-l "a.c
+exit 0"
+
+# -r with \N
+cp a.c r.c
+t -r 'set_\1' -e 'get_(.*)' r.c
+check subst-run "exit 0"
+got=$(grep -n '_len' r.c)
+check subst "8:/* get_len gives the length */
+10:set_len(struct buf *b)"
+cp a.c r.c
+t -r 'n\0\\' -e len r.c
+got=$(grep -c 'nlen\\[ ;]' r.c)
+check subst-backslash "3"
+cp a.c r.c
+t -r 'x\\y' -e len r.c
+got=$(grep -c 'x\\\\y' r.c)
+check subst-literal "3"
+
+# --rename-map
+cp b.c m.c
+printf 'recv_msg\treceive_msg\nrecieve_msg\treceive_msg\n' >map
+t --rename-map=map m.c
+got=$(head -2 m.c)
+check rename-map "int receive_msg;
+int receive_msg(void);"
+printf 'lock_acquire\tlock_release\nlock_release\tlock_acquire\n' >map
+cp b.c m.c
+t --rename-map=map m.c
+got=$(grep lock_ m.c)
+check rename-swap "	lock_release();
+	lock_acquire();"
+
+# .cgp images
+t --compile-patterns p.cgp -e 'lock_(acquire|release)'
+check cgp-compile "exit 0"
+t -n --patterns p.cgp a.c b.c
+check cgp "a.c:   18: 	lock_acquire();
+b.c:    7: 	lock_acquire();
+b.c:    9: 	lock_release();
+exit 0"
+head -c 100 p.cgp >q.cgp
+t --patterns q.cgp a.c
+check cgp-short "cgrep: q.cgp is corrupt
+exit 1"
+cp p.cgp q.cgp
+damage q.cgp 4
+t --patterns q.cgp a.c
+check cgp-damaged "cgrep: q.cgp is corrupt
+exit 1"
+
+# --json and --null
+t --json 'b->len' a.c
+check json '{"path":"a.c","line":12,"column":9,"offset":142,"length":6,"match":"b->len"}
+{"path":"a.c","line":21,"column":2,"offset":269,"length":6,"match":"b->len"}
+exit 0'
+t --json -l lock_acquire a.c b.c
+check json-l '{"path":"a.c"}
+{"path":"b.c"}
+exit 0'
+got=$(cgrep --null lock_release b.c a.c | tr '\0' '|')
+check null "b.c|9|2|108|12|lock_release|"
+got=$(cgrep --null -l lock_acquire a.c b.c | tr '\0' '|')
+check null-l "a.c|b.c|"
+t --json -s len a.c
+got=$(echo "$got" | tail -n 1)
+check json-s "exit 1"
+
+# --quickfix, to a file and to a FIFO
+want="a.c:5:9:	size_t len;
+a.c:12:12:	return b->len;
+a.c:21:5:	b->len = strlen(s);"
+t --quickfix=qf len a.c
+check quickfix-run "exit 0"
+got=$(cat qf)
+check quickfix "$want"
+mkfifo qf.fifo
+cgrep --quickfix=qf.fifo len a.c </dev/null &
+got=$(cat qf.fifo)
+wait $!
+check quickfix-fifo "$want"
+t --quickfix=qf -l len a.c
+got=$(echo "$got" | tail -n 1)
+check quickfix-l "exit 1"
+
+# .tar and .tgz archives
+tar cf s.tar a.c b.c
+gzip -c s.tar >s.tgz
+t -n lock_acquire s.tar
+check tar "s.tar:a.c:   18: 	lock_acquire();
+s.tar:b.c:    7: 	lock_acquire();
+exit 0"
+t -l lock_release s.tgz
+check tgz "s.tgz:b.c
+exit 0"
+head -c 100 s.tgz >t.tgz
+t -l lock_release t.tgz
+check tgz-short "cgrep: warning t.tgz is cut short
+exit 0"
+t --tags=tags lock_acquire s.tar
+check tar-tags "cgrep: --tags cannot search archive s.tar
+exit 1"
+
+# --index
+mkdir ix
+cp a.c b.c ix
+t --index build ix
+check index-build "exit 0"
+t -n --index query 'lock_.*' ix
+check index-query "ix/a.c:   18: 	lock_acquire();
+ix/b.c:    7: 	lock_acquire();
+ix/b.c:    9: 	lock_release();
+exit 0"
+t --index query -s -e 'lock %s' ix
+check index-strings 'ix/b.c: lock %s\n
+exit 0'
+cp ix/.cgrepidx ix.good
+printf '\377\377\377\017' |		# nfile, size and magic left alone
+    dd of=ix/.cgrepidx bs=1 seek=8 conv=notrunc 2>/dev/null
+t --index query foo_bar ix
+check index-damaged "cgrep: ix/.cgrepidx is damaged, use --index build
+exit 1"
+mv ix.good ix/.cgrepidx
+
+# --cache: a damaged entry is lexed again
+want="a.c:   12: 	return b->len;
+a.c:   21: 	b->len = strlen(s);
+exit 0"
+t -n --cache=cache -e 'b->len' a.c
+check cache-miss "$want"
+tv -n --verbose --cache=cache -e 'b->len' a.c
+check cache-hit "$want"
+got=$err
+check cache-hit-verbose "cgrep: cache: 1 files found, 0 lexed"
+for f in cache/*; do
+	damage "$f" 4
+done
+tv -n --verbose --cache=cache -e 'b->len' a.c
+check cache-damaged "$want"
+got=$err
+check cache-damaged-verbose "cgrep: cache: 0 files found, 1 lexed"
+for n in abc -1 0; do
+	t --cache=cache --cache-size=$n -e 'b->len' a.c
+	got=$(echo "$got" | tail -n 1)
+	check "cache-size=$n" "exit 1"
+done
+set -- cache/*
+got=$#
+check cache-kept "1"
+
+# --results: a damaged file is ignored
+want="a.c:   18: 	lock_acquire();
+b.c:    7: 	lock_acquire();
+exit 0"
+t -n --results=results lock_acquire a.c b.c
+check results-first "$want"
+tv -n --verbose --results=results lock_acquire a.c b.c
+check results-kept "$want"
+got=$err
+check results-kept-verbose \
+    "cgrep: results: 2 kept, 0 the same, 0 searched"
+for f in results/*; do
+	damage "$f" 1
+done
+tv -n --verbose --results=results lock_acquire a.c b.c
+check results-damaged "$want"
+got=$err
+check results-damaged-verbose \
+    "cgrep: results: 0 kept, 0 the same, 2 searched"
+
+# --checkpoints: a damaged file is ignored
+want="a.c:    5: 	size_t len;
+a.c:   12: 	return b->len;
+a.c:   21: 	b->len = strlen(s);
+exit 0"
+t -n --checkpoints=ck len a.c
+check ckpt-first "$want"
+damage ck 1
+tv -n --verbose --checkpoints=ck len a.c
+check ckpt-damaged "$want"
+got=$err
+check ckpt-damaged-verbose "cgrep: checkpoints: lexed from line 1"
+
+# --watch, on a directory named with a trailing /
+mkdir w
+printf 'int foo;\nint foo2;\n' >w/x.c
+cgrep --watch -n 'foo.*' w/ >out 2>&1 </dev/null &
+pid=$!
+sleep 1
+printf 'int foo;\nint bar;\nint foo3;\n' >w/x.c
+sleep 2
+kill $pid
+wait $pid 2>/dev/null
+got=$(cat out)
+check watch-slash "w/x.c:    1: int foo;
+w/x.c:    2: int foo2;
+-w/x.c:    2: int foo2;
++w/x.c:    3: int foo3;"
+
+# --serve and --connect, from another directory
+cgrep --serve="$tmp/sock" a.c b.c 2>/dev/null </dev/null &
+pid=$!
+sleep 1
+mkdir sv
+cd sv
+echo lock_release >pats
+t -n --connect="$tmp/sock" 'lock_.*'
+check connect "a.c:   18: 	lock_acquire();
+b.c:    7: 	lock_acquire();
+b.c:    9: 	lock_release();
+exit 0"
+t -l --connect="$tmp/sock" -f pats
+check connect-f "b.c
+exit 0"
+t --connect="$tmp/sock" --tokens='memcpy ...'
+check connect-fatal "cgrep: --tokens: nothing after ...
+exit 1"
+cd ..
+kill $pid
+wait $pid 2>/dev/null
+
+# --tags
+t --tags=tags -e lock_acquire a.c b.c
+check tags-search "a.c: 	lock_acquire();
+b.c: 	lock_acquire();
+exit 0"
+got=$(cut -f 1,2 tags)
+check tags "buf	a.c
+copy	a.c
+get_len	a.c
+post	b.c"
+for n in x 0 -2; do
+	t --tags=tags --jobs=$n -e lock_acquire a.c b.c
+	got=$(echo "$got" | tail -n 1)
+	check "jobs=$n" "exit 1"
+done
+t --tags=tags --jobs=2 a.c b.c
+check tags-jobs "exit 0"
+got=$(cut -f 1 tags | tr '\n' ' ')
+check tags-jobs-tags "buf copy get_len post "
+t --tags=tags		# usage, not a read of stdin
+got=$(echo "$got" | tail -n 1)
+check tags-nofiles "exit 1"
+
+# --git and revisions
+if command -v git >/dev/null; then
+	mkdir g
+	cd g
+	git init -q
+	for f in one two three; do
+		echo "int $f;" >$f.c
+		git add $f.c
+		git -c user.name=t -c user.email=t@t commit -q -m $f
+	done
+	t -l --git --changed-since=HEAD~2 int
+	check git-tilde "three.c
+two.c
+exit 0"
+	t -l --git --changed-since=@~2 int
+	check git-at "three.c
+two.c
+exit 0"
+	t -l --git --changed-since=HEAD^ int
+	check git-caret "three.c
+exit 0"
+	t -n --rev=HEAD~1 --rev=HEAD 'one|three'
+	check rev "HEAD~1:one.c:    1: int one;
+HEAD:one.c:    1: int one;
+HEAD:three.c:    1: int three;
+exit 0"
+	cd ..
+	# a parent missing from the object store
+	git clone -q --depth 1 "file://$tmp/g" shallow
+	cd shallow
+	t --rev=HEAD~1 int
+	check rev-shallow "cgrep: HEAD~1: no such revision
+exit 1"
+	t --git --changed-since=HEAD~1 int
+	check git-shallow "cgrep: HEAD~1: no such revision
+exit 1"
+	cd ..
+fi
+
+echo "$ntest tests, $nfail failed"
+exit $nfail
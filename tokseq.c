@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+/*
+ * Token sequence patterns, for --tokens.
+ *
+ * A sequence is a list of elements: identifier patterns, punctuation,
+ * and gaps. tscomp() turns it into an automaton with a state per
+ * element, "the elements before this one are matched", and tsstep()
+ * moves it on by each token lex() hands the tokhook. A state behind a
+ * gap waits for its element for as many tokens as the gap allows,
+ * counting how many it has waited; if the state is entered again it
+ * starts counting afresh, as the later start leaves the most room. So
+ * each token costs a look at each live state, whatever the input.
+ */
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cgrep.h"
+
+struct tselem {
+	int c;			/* punctuation, or 0 for an identifier */
+	struct patset *ps;	/* matching it */
+	char *src;		/* and as given */
+	int gap;		/* tokens that may come before it */
+	int at;			/* tokens waited in this state, -1 if dead */
+};
+
+static struct tselem *elems;
+static int nelem, elemsLen;
+
+/*
+ * Compile the sequence seq. Elements are separated by white space. One
+ * made only of punctuation and digits, such as ( or -> or 0, is those
+ * characters each a token, as lex() gives them; ... is a gap of any
+ * number of tokens and ...n of at most n, neither going past a ; { or }
+ * and each needing an element after it; anything else, or anything in
+ * double quotes, is a pattern for an identifier, matched as cgrep's
+ * pattern is.
+ */
+void
+tscomp(const char *seq)
+{
+	const char *s, *p = seq, *g = NULL;
+	char *pat;
+	size_t n, gn = 0;
+	int gap = 0, i, j, quoted;
+
+	for (;;) {
+		while (isspace((unsigned char)*p))
+			p++;
+		if ('\0' == *p)
+			break;
+		if ((quoted = '"' == *p)) {
+			s = ++p;
+			if (NULL == (p = strchr(s, '"')))
+				fatal("%s: --tokens: unmatched \"\n",
+				    getprogname());
+			n = p++ - s;
+		}
+		else {
+			for (s = p; '\0' != *p && !isspace((unsigned char)*p);)
+				p++;
+			n = p - s;
+		}
+		if (!quoted && 3 <= n && !strncmp(s, "...", 3)) {
+			if (3 == n)
+				gap = INT_MAX;
+			else if (n == 3 + strspn(s + 3, "0123456789"))
+				gap = atoi(s + 3);
+			else
+				fatal("%s: --tokens: bad gap %.*s\n",
+				    getprogname(), (int)n, s);
+			g = s;
+			gn = n;
+			continue;
+		}
+		for (i = 0; !quoted && i < (int)n; i++)
+			if ((!ispunct((unsigned char)s[i]) &&
+			    !isdigit((unsigned char)s[i])) || '"' == s[i] ||
+			    '\'' == s[i])
+				break;
+		if (!quoted && i == (int)n) {	/* punctuation, numbers */
+			for (i = 0; i < (int)n; i++) {
+				TROOM(elems, elemsLen, nelem);
+				elems[nelem].c = (unsigned char)s[i];
+				elems[nelem].ps = NULL;
+				elems[nelem].src = NULL;
+				elems[nelem++].gap = i ? 0 : gap;
+			}
+			gap = 0;
+			g = NULL;
+			continue;
+		}
+		pat = alloc(n + 1);
+		memcpy(pat, s, n);
+		TROOM(elems, elemsLen, nelem);
+		elems[nelem].c = 0;
+		elems[nelem].ps = NULL;
+		elems[nelem].src = pat;
+		for (j = 0; j < nelem; j++)	/* one of each */
+			if (0 == elems[j].c && !strcmp(pat, elems[j].src))
+				elems[nelem].ps = elems[j].ps;
+		if (NULL == elems[nelem].ps) {
+			elems[nelem].ps = psnew();
+			psadd(elems[nelem].ps, pat);
+			psfreeze(elems[nelem].ps);
+		}
+		elems[nelem++].gap = gap;
+		gap = 0;
+		g = NULL;
+	}
+	if (0 == nelem)
+		fatal("%s: --tokens: empty sequence\n", getprogname());
+	if (NULL != g)
+		fatal("%s: --tokens: nothing after %.*s\n", getprogname(),
+		    (int)gn, g);
+	tsstep(EOF, NULL, 0);
+}
+
+/*
+ * Move the automaton on by a token: punctuation c, or the identifier w,
+ * n if c is 0. Returns 1 if that completes the sequence. EOF starts it
+ * again.
+ */
+int
+tsstep(int c, const char *w, size_t n)
+{
+	struct tselem *e;
+	int i, hit = 0;
+
+	if (EOF == c) {
+		for (i = 0; i < nelem; i++)
+			elems[i].at = -1;
+		elems[0].at = 0;
+		return 0;
+	}
+	/* from the end, so a state entered now is not tried on this token */
+	for (i = nelem - 1; i >= 0; i--) {
+		e = &elems[i];
+		if (-1 == e->at)
+			continue;
+		if ((0 == e->c) ? (0 == c && psmatch(e->ps, w, n)) :
+		    c == e->c) {
+			if (i + 1 == nelem)
+				hit = 1;
+			else
+				elems[i + 1].at = 0;
+		}
+		if (0 == i)	/* the sequence may start anywhere */
+			continue;
+		if (e->at++ >= e->gap || ';' == c || '{' == c || '}' == c)
+			e->at = -1;
+	}
+	return hit;
+}
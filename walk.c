@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Finding the sources under a directory.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <fnmatch.h>
+#include <fts.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cgrep.h"
+
+struct walked *files;		/* files found by walk() */
+size_t nfiles;
+static size_t filesLen;
+
+static const char **globs;	/* --include and --exclude patterns */
+static char *globin;		/* whether each is an --include */
+static size_t nglob, globsLen, globinLen;
+
+/*
+ * If set, walk() hands every directory it enters to dirhook.
+ */
+void (*dirhook)(const char *);
+
+/*
+ * Take files matching glob, in place of the usual suffixes if include is
+ * set, or leave them out if not. A glob with a / is matched against the
+ * whole path, as cgrep names it, others against the last component.
+ */
+void
+addglob(const char *glob, int include)
+{
+	TROOM(globs, globsLen, nglob);
+	ROOM(globin, globinLen, nglob);
+	globs[nglob] = glob;
+	globin[nglob++] = include;
+}
+
+/*
+ * Is name a C, C++, yacc or lex source, or one --include asks for, and
+ * not one --exclude leaves out? Name may be a path.
+ */
+int
+csource(const char *name)
+{
+	static const char *const suffix[] = {
+		"c", "h", "cc", "cpp", "cxx", "hh", "hpp", "hxx", "y", "l", NULL
+	};
+	const char *const *s;
+	const char *base, *dot;
+	int included = -1;
+	size_t i;
+
+	base = (NULL != (dot = strrchr(name, '/'))) ? dot + 1 : name;
+	for (i = 0; i < nglob; i++) {
+		if (globin[i] && -1 == included)
+			included = 0;	/* some --include must match */
+		if (0 == fnmatch(globs[i], strchr(globs[i], '/') ? name : base,
+		    0)) {
+			if (!globin[i])
+				return 0;
+			included = 1;
+		}
+	}
+	if (-1 != included)
+		return included;
+
+	if (NULL == (dot = strrchr(base, '.')))
+		return 0;
+	for (s = suffix; NULL != *s; s++)
+		if (!strcmp(dot + 1, *s))
+			return 1;
+	return 0;
+}
+
+static int
+walkcmp(const void *a, const void *b)
+{
+	return strcmp(((const struct walked *)a)->rel,
+	    ((const struct walked *)b)->rel);
+}
+
+/*
+ * Find the sources under dir, skipping dot files and directories, and
+ * leave them sorted by path in files. A dir that is a plain file is
+ * taken whatever its name.
+ */
+void
+walk(const char *dir)
+{
+	char *argv[2];
+	FTS *fts;
+	FTSENT *e;
+	struct walked *w;
+	size_t i;
+
+	for (i = 0; i < nfiles; i++)
+		free(files[i].path);
+	nfiles = 0;
+
+	argv[0] = (char *)dir;
+	argv[1] = NULL;
+	if (NULL == (fts = fts_open(argv, FTS_PHYSICAL | FTS_NOCHDIR, NULL)))
+		fatal("%s: cannot walk %s\n", getprogname(), dir);
+	while (NULL != (e = fts_read(fts))) {
+		if (e->fts_level > 0 && '.' == e->fts_name[0]) {
+			if (FTS_D == e->fts_info)
+				fts_set(fts, e, FTS_SKIP);
+			continue;
+		}
+		if (FTS_D == e->fts_info && NULL != dirhook)
+			(*dirhook)(e->fts_path);
+		if (FTS_F != e->fts_info || (e->fts_level > 0 &&
+		    (!csource(e->fts_path) || tarname(e->fts_path))))
+			continue;	/* archives only when named */
+		TROOM(files, filesLen, nfiles);
+		w = &files[nfiles++];
+		w->path = strdup(e->fts_path);
+		if (NULL == w->path)
+			fatal(outSpace);
+		for (w->rel = w->path + strlen(dir); '/' == *w->rel; w->rel++)
+			;
+		w->size = e->fts_statp->st_size;
+		w->mtim = e->fts_statp->st_mtim;
+	}
+	fts_close(fts);
+	qsort(files, nfiles, sizeof(*files), walkcmp);
+}
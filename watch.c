@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) 1977-1995 by Robert Swartz.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Watch mode.
+ *
+ * After the first search every directory walked is watched with
+ * inotify(7). Events are taken in batches: each file written, created,
+ * moved or removed in the batch is lexed again on its own, and its new
+ * hits compared with those it had. Hits are paired by the text of the
+ * line, so lines that merely moved are not reported; the rest are
+ * printed as lost (-) or gained (+). An update costs what lexing the
+ * changed files costs, whatever the size of the tree.
+ *
+ * Without inotify the files found by the first search are polled with
+ * stat() each second instead, and new files are not seen.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cgrep.h"
+
+struct hit {		/* a line found */
+	int line;
+	char *text;
+};
+
+struct wfile {		/* a file watched */
+	char *path;
+	struct hit *hits;	/* as of the last time it was lexed */
+	size_t nhit;
+	off_t size;		/* for polling */
+	struct timespec mtim;
+	char dirty;		/* changed in this batch */
+};
+
+static struct wfile *wfiles;
+static size_t nwfile, wfilesLen;
+static uint32_t *wtab;		/* wfile number + 1 by path hash, 0 is empty */
+static uint32_t wmask;
+
+static size_t *dirty;		/* wfile numbers to lex again */
+static size_t ndirty, dirtyLen;
+
+static struct hit *got;		/* hits of the file being lexed */
+static size_t ngot, gotLen;
+
+static char listonly;		/* -l */
+static char numbered;		/* -n */
+
+/*
+ * The hithook: keep a hit of the file being lexed.
+ */
+static void
+collect(const char *s, int line)
+{
+	TROOM(got, gotLen, ngot);
+	got[ngot].line = line;
+	if (NULL == (got[ngot].text = strdup(s)))
+		fatal(outSpace);
+	ngot++;
+}
+
+/*
+ * The file named path, entered if new and add is set, or NULL.
+ */
+static struct wfile *
+find(const char *path, int add)
+{
+	struct wfile *wf;
+	uint32_t slot, i, *nt;
+
+	for (slot = fnv(path, strlen(path)) & wmask; 0 != wtab[slot];
+	    slot = (slot + 1) & wmask)
+		if (!strcmp(wfiles[wtab[slot] - 1].path, path))
+			return &wfiles[wtab[slot] - 1];
+	if (!add)
+		return NULL;
+
+	TROOM(wfiles, wfilesLen, nwfile);
+	wf = &wfiles[nwfile];
+	memset(wf, 0, sizeof(*wf));
+	if (NULL == (wf->path = strdup(path)))
+		fatal(outSpace);
+	wtab[slot] = ++nwfile;
+
+	if (nwfile > wmask / 2) {	/* grow the table */
+		nt = alloc(sizeof(*nt) * 2 * (wmask + 1));
+		wmask = 2 * wmask + 1;
+		for (i = 0; i < nwfile; i++) {
+			path = wfiles[i].path;
+			for (slot = fnv(path, strlen(path)) & wmask;
+			    0 != nt[slot]; slot = (slot + 1) & wmask)
+				;
+			nt[slot] = i + 1;
+		}
+		free(wtab);
+		wtab = nt;
+	}
+	return wf;
+}
+
+/*
+ * Print hit h of path, after sign if that is set.
+ */
+static void
+show(int sign, const char *path, const struct hit *h)
+{
+	char c = sign;
+
+	if (sign)
+		owrite(&c, 1);
+	oputs(path);
+	if (listonly) {
+		owrite("\n", 1);
+		return;
+	}
+	owrite(": ", 2);
+	if (numbered) {
+		onum(h->line, 4);
+		owrite(": ", 2);
+	}
+	oputs(h->text);
+	owrite("\n", 1);
+}
+
+static int
+hitcmp(const void *a, const void *b)
+{
+	const struct hit *x = *(const struct hit *const *)a;
+	const struct hit *y = *(const struct hit *const *)b;
+	int r;
+
+	if (0 != (r = strcmp(x->text, y->text)))
+		return r;
+	return (x->line > y->line) - (x->line < y->line);
+}
+
+/*
+ * Print how the hits of wf differ from those just got. Lines with the
+ * same text are paired off in order; what is left was lost or gained.
+ */
+static void
+delta(const struct wfile *wf)
+{
+	struct hit **o, **n;
+	char *okeep, *nkeep;
+	size_t i, j;
+	int r;
+
+	if (listonly) {
+		if (!wf->nhit != !ngot)
+			show(ngot ? '+' : '-', wf->path, NULL);
+		return;
+	}
+
+	o = alloc(sizeof(*o) * (wf->nhit + 1));
+	n = alloc(sizeof(*n) * (ngot + 1));
+	okeep = alloc(wf->nhit + 1);
+	nkeep = alloc(ngot + 1);
+	for (i = 0; i < wf->nhit; i++)
+		o[i] = &wf->hits[i];
+	for (j = 0; j < ngot; j++)
+		n[j] = &got[j];
+	qsort(o, wf->nhit, sizeof(*o), hitcmp);
+	qsort(n, ngot, sizeof(*n), hitcmp);
+	for (i = j = 0; i < wf->nhit && j < ngot; )
+		if (0 == (r = strcmp(o[i]->text, n[j]->text))) {
+			okeep[o[i++] - wf->hits] = 1;
+			nkeep[n[j++] - got] = 1;
+		}
+		else if (r < 0)
+			i++;
+		else
+			j++;
+
+	for (i = 0; i < wf->nhit; i++)
+		if (!okeep[i])
+			show('-', wf->path, &wf->hits[i]);
+	for (j = 0; j < ngot; j++)
+		if (!nkeep[j])
+			show('+', wf->path, &got[j]);
+	free(o);
+	free(n);
+	free(okeep);
+	free(nkeep);
+}
+
+/*
+ * Lex wf again, or take it as empty if it is gone, and report its hits:
+ * all of them the first time, otherwise how they changed.
+ */
+static void
+rescan(struct wfile *wf, int first)
+{
+	struct stat st;
+	size_t i;
+
+	ngot = 0;
+	if (-1 == stat(wf->path, &st))
+		wf->size = -1;
+	else {
+		wf->size = st.st_size;
+		wf->mtim = st.st_mtim;
+		filen = wf->path;
+		lex();
+	}
+
+	if (!first)
+		delta(wf);
+	else if (listonly && ngot)
+		show(0, wf->path, NULL);
+	else if (!listonly)
+		for (i = 0; i < ngot; i++)
+			show(0, wf->path, &got[i]);
+
+	for (i = 0; i < wf->nhit; i++)
+		free(wf->hits[i].text);
+	free(wf->hits);
+	wf->hits = NULL;
+	if (0 != (wf->nhit = ngot)) {
+		wf->hits = alloc(sizeof(*got) * ngot);
+		memcpy(wf->hits, got, sizeof(*got) * ngot);
+	}
+	wf->dirty = 0;
+}
+
+/*
+ * Have wf lexed again at the end of the batch.
+ */
+static void
+mark(struct wfile *wf)
+{
+	if (NULL == wf || wf->dirty)
+		return;
+	wf->dirty = 1;
+	TROOM(dirty, dirtyLen, ndirty);
+	dirty[ndirty++] = wf - wfiles;
+}
+
+#ifdef __linux__
+struct wdir {		/* a directory watched, by watch descriptor */
+	char *path;
+	char all;		/* every source in it, not just those named */
+};
+
+static struct wdir *wdirs;
+static size_t wdirsLen;
+static int ifd;			/* inotify descriptor */
+
+#define WEVENTS	(IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+		 IN_MOVED_TO)
+
+/*
+ * Watch directory path, "" being the current one named by the files in
+ * it; all if every source in it is of interest.
+ */
+static void
+watchdir(const char *path, int all)
+{
+	size_t was = wdirsLen;
+	int wd;
+
+	if (-1 == (wd = inotify_add_watch(ifd, ('\0' == *path) ? "." : path,
+	    WEVENTS))) {
+		fprintf(stderr, "%s: warning cannot watch %s\n",
+		    getprogname(), ('\0' == *path) ? "." : path);
+		return;
+	}
+	TROOM(wdirs, wdirsLen, (size_t)wd);
+	memset(wdirs + was, 0, sizeof(*wdirs) * (wdirsLen - was));
+	if (NULL == wdirs[wd].path &&
+	    NULL == (wdirs[wd].path = strdup(path)))
+		fatal(outSpace);
+	wdirs[wd].all |= all;
+}
+
+/*
+ * The dirhook: watch every directory walked.
+ */
+static void
+walkdir(const char *path)
+{
+	watchdir(path, 1);
+}
+#endif
+
+/*
+ * Search the sources under paths, then keep reporting how the hits
+ * change as the files do; list and number are -l and -n.
+ */
+__dead void
+watch(int npath, char **paths, int list, int number)
+{
+	size_t i;
+	struct stat st;
+#ifdef __linux__
+	union {
+		struct inotify_event ev;
+		char buf[64 * 1024];
+	} u;
+	const struct inotify_event *ev;
+	struct wdir *d;
+	const char *p;
+	char *path = NULL, *slash;
+	size_t pathLen = 0, k;
+	ssize_t n;
+
+	if (-1 == (ifd = inotify_init()))
+		fatal("%s: cannot start inotify\n", getprogname());
+	dirhook = walkdir;
+#endif
+
+	listonly = list;
+	numbered = number;
+	hithook = collect;
+	wmask = 1023;
+	wtab = alloc(sizeof(*wtab) * (wmask + 1));
+
+	for (; npath > 0; npath--, paths++) {
+		walk(*paths);
+#ifdef __linux__
+		if (-1 != stat(*paths, &st) && !S_ISDIR(st.st_mode)) {
+			/* just the file, from its directory */
+			k = strlen(*paths);
+			ROOM(path, pathLen, k + 2);
+			strcpy(path, *paths);
+			if (NULL == (slash = strrchr(path, '/')))
+				path[0] = '\0';
+			else if (slash == path)
+				path[1] = '\0';
+			else
+				*slash = '\0';
+			watchdir(path, 0);
+		}
+#endif
+		for (i = 0; i < nfiles; i++)
+			rescan(find(files[i].path, 1), 1);
+	}
+	oflush();
+
+	for (;;) {
+		ndirty = 0;
+#ifdef __linux__
+		if (-1 == (n = read(ifd, u.buf, sizeof(u.buf)))) {
+			if (EINTR == errno)
+				continue;
+			fatal("%s: cannot read inotify events\n",
+			    getprogname());
+		}
+		for (p = u.buf; p < u.buf + n; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			if (IN_Q_OVERFLOW & ev->mask) {	/* lost some */
+				for (i = 0; i < nwfile; i++)
+					mark(&wfiles[i]);
+				continue;
+			}
+			if (ev->wd < 0 || (size_t)ev->wd >= wdirsLen ||
+			    NULL == (d = &wdirs[ev->wd])->path)
+				continue;
+			if (IN_IGNORED & ev->mask) {	/* directory gone */
+				free(d->path);
+				d->path = NULL;
+				continue;
+			}
+			if (0 == ev->len || '.' == ev->name[0])
+				continue;
+
+			/* joined as fts(3) does, so d/ gives d/x.c */
+			k = strlen(d->path);
+			ROOM(path, pathLen, k + strlen(ev->name) + 2);
+			sprintf(path, "%s%s%s", d->path,
+			    (0 == k || '/' == d->path[k - 1]) ? "" : "/",
+			    ev->name);
+			if (IN_ISDIR & ev->mask) {	/* new directory */
+				if (!d->all || !((IN_CREATE | IN_MOVED_TO) &
+				    ev->mask))
+					continue;
+				walk(path);
+				for (i = 0; i < nfiles; i++)
+					mark(find(files[i].path, 1));
+				continue;
+			}
+			mark(find(path, d->all && csource(ev->name) &&
+			    !tarname(ev->name)));
+			if (0 == k || !strcmp(d->path, ".")) {
+				/* x.c and ./x.c share the watch */
+				ROOM(path, pathLen, strlen(ev->name) + 3);
+				sprintf(path, "%s%s", k ? "" : "./", ev->name);
+				mark(find(path, 0));
+			}
+		}
+#else
+		sleep(1);
+		for (i = 0; i < nwfile; i++)
+			if ((-1 == stat(wfiles[i].path, &st)) ?
+			    (-1 != wfiles[i].size) :
+			    (st.st_size != wfiles[i].size ||
+			    st.st_mtim.tv_sec != wfiles[i].mtim.tv_sec ||
+			    st.st_mtim.tv_nsec != wfiles[i].mtim.tv_nsec))
+				mark(&wfiles[i]);
+#endif
+		for (i = 0; i < ndirty; i++)
+			rescan(&wfiles[dirty[i]], 0);
+		oflush();
+	}
+}